@@ -0,0 +1,232 @@
+#include "Animation.hpp"
+
+#include <QBuffer>
+#include <QImageReader>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "Decoder.hpp"
+#include "log.hpp"
+
+// frames decoded ahead of the one being shown
+constexpr size_t ring_capacity = 4;
+
+// how often to check back when the decoder has fallen behind the playhead
+constexpr auto poll_interval = 5;
+
+// browsers show frames with tiny delays for 100ms, and plenty of files depend on that
+constexpr auto min_frame_delay = 10;
+constexpr auto default_frame_delay = 100;
+
+struct Frame
+{
+	QImage image;
+	int delay = 0;
+};
+
+struct AnimationPlayer::State
+{
+	QByteArray content;
+	QSize size;
+
+	std::mutex mutex;
+	std::deque<Frame> frames;
+	bool decoding = false;
+	bool stopped = false;
+	bool finished = false;
+
+	// only touched by the decode task, of which there is at most one at a time
+	std::unique_ptr<QBuffer> buffer;
+	std::unique_ptr<QImageReader> reader;
+	int loopsPlayed = 0;
+
+	bool restart() noexcept
+	{
+		if (reader)
+		{
+			// a loop count of -1 repeats forever, otherwise it is the number of repeats after the first play
+			auto loopCount = reader->loopCount();
+			if (loopCount >= 0 && loopsPlayed >= loopCount)
+				return false;
+
+			++loopsPlayed;
+		}
+
+		reader.reset();
+		buffer = std::make_unique<QBuffer>();
+		buffer->setData(content);
+		buffer->open(QIODevice::ReadOnly);
+
+		reader = std::make_unique<QImageReader>(buffer.get());
+		if (size.isValid())
+			reader->setScaledSize(size);
+
+		return reader->canRead();
+	}
+
+	Frame decodeFrame() noexcept
+	{
+		if (!reader || !reader->canRead())
+		{
+			if (!restart())
+				return {};
+		}
+
+		QImage image;
+		if (!reader->read(&image))
+			return {};
+
+		auto delay = reader->nextImageDelay();
+		if (delay <= min_frame_delay)
+			delay = default_frame_delay;
+
+		auto format = displayFormat(image.hasAlphaChannel());
+		if (image.format() != format)
+			image = std::move(image).convertToFormat(format);
+
+		return {std::move(image), delay};
+	}
+};
+
+class FrameDecodeTask final : public QRunnable
+{
+public:
+	explicit FrameDecodeTask(std::shared_ptr<AnimationPlayer::State> state) noexcept : state(std::move(state))
+	{
+	}
+
+private:
+	void run() override
+	{
+		for (;;)
+		{
+			{
+				std::lock_guard lock(state->mutex);
+				if (state->stopped || state->frames.size() >= ring_capacity)
+				{
+					state->decoding = false;
+					return;
+				}
+			}
+
+			auto frame = state->decodeFrame();
+
+			std::lock_guard lock(state->mutex);
+			if (frame.image.isNull())
+			{
+				state->finished = true;
+				state->decoding = false;
+				return;
+			}
+
+			state->frames.push_back(std::move(frame));
+		}
+	}
+
+	std::shared_ptr<AnimationPlayer::State> state;
+};
+
+AnimationPlayer::AnimationPlayer(QByteArray content, QSize size, QObject *parent) noexcept
+	: QObject(parent), state(std::make_shared<State>()), frameSize(size), timer(new QTimer(this))
+{
+	state->content = std::move(content);
+	state->size = size;
+
+	timer->setSingleShot(true);
+	timer->setTimerType(Qt::PreciseTimer);
+	connect(timer, &QTimer::timeout, this, &AnimationPlayer::showNextFrame);
+
+	clock.start();
+	scheduleDecode();
+}
+
+AnimationPlayer::~AnimationPlayer()
+{
+	std::lock_guard lock(state->mutex);
+	state->stopped = true;
+}
+
+QSize AnimationPlayer::size() const noexcept
+{
+	return frameSize;
+}
+
+int64_t AnimationPlayer::bufferBytes() const noexcept
+{
+	if (frameSize.isEmpty())
+		return 0;
+
+	// frames are converted to the 32-bit display format
+	return int64_t{ring_capacity} * frameSize.width() * frameSize.height() * 4;
+}
+
+void AnimationPlayer::setPlaying(bool play) noexcept
+{
+	if (playing == play)
+		return;
+
+	playing = play;
+
+	if (playing)
+	{
+		deadline = clock.elapsed();
+		timer->start(0);
+	}
+	else
+		timer->stop();
+}
+
+bool AnimationPlayer::isPlaying() const noexcept
+{
+	return playing;
+}
+
+void AnimationPlayer::showNextFrame() noexcept
+{
+	Frame frame;
+
+	{
+		std::lock_guard lock(state->mutex);
+		if (state->frames.empty())
+		{
+			// either the end of a non-looping animation, or the decoder hasn't caught up yet
+			if (!state->finished)
+				timer->start(poll_interval);
+			return;
+		}
+
+		frame = std::move(state->frames.front());
+		state->frames.pop_front();
+	}
+
+	scheduleDecode();
+	emit frameReady(std::move(frame.image));
+
+	// schedule against when the frame was due rather than when it got shown so timing doesn't drift,
+	// unless a stall put us more than a frame behind
+	auto now = clock.elapsed();
+	if (now - deadline > frame.delay)
+		deadline = now;
+
+	deadline += frame.delay;
+	timer->start(int(std::max<qint64>(0, deadline - now)));
+}
+
+void AnimationPlayer::scheduleDecode() noexcept
+{
+	{
+		std::lock_guard lock(state->mutex);
+		if (state->decoding || state->stopped || state->finished || state->frames.size() >= ring_capacity)
+			return;
+
+		state->decoding = true;
+	}
+
+	QThreadPool::globalInstance()->start(new FrameDecodeTask(state));
+}
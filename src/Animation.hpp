@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QObject>
+#include <QSize>
+
+#include <cstdint>
+#include <memory>
+
+class QTimer;
+
+// Plays an animated image by decoding frames on the thread pool just ahead of the one on screen.
+// Only a few frames are held at a time, so long animations cost no more memory than short ones.
+// While paused, decoding stops as soon as the buffer is full.
+class AnimationPlayer final : public QObject
+{
+	Q_OBJECT
+
+public:
+	AnimationPlayer(QByteArray content, QSize size, QObject *parent = nullptr) noexcept;
+	~AnimationPlayer() override;
+
+	AnimationPlayer(const AnimationPlayer &) = delete;
+	AnimationPlayer &operator=(const AnimationPlayer &) = delete;
+	AnimationPlayer(AnimationPlayer &&) = delete;
+	AnimationPlayer &operator=(AnimationPlayer &&) = delete;
+
+	QSize size() const noexcept;
+
+	// The most the frames decoded ahead take up, for memory accounting
+	int64_t bufferBytes() const noexcept;
+
+	void setPlaying(bool play) noexcept;
+	bool isPlaying() const noexcept;
+
+signals:
+	void frameReady(QImage frame);
+
+private:
+	void showNextFrame() noexcept;
+	void scheduleDecode() noexcept;
+
+public:
+	struct State;
+
+private:
+	std::shared_ptr<State> state;
+	QSize frameSize;
+	QTimer *timer;
+
+	QElapsedTimer clock;
+	qint64 deadline = 0;
+	bool playing = false;
+};
@@ -1,15 +1,20 @@
 #include "Archive.hpp"
 
+#include <QFile>
 #include <QLibrary>
 #include <QMimeDatabase>
+#include <QThread>
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include <limits>
 #include <memory>
+#include <optional>
 #include <type_traits>
 #include <utility>
 
+#include "RepackCache.hpp"
 #include "log.hpp"
 
 template <auto fn>
@@ -20,19 +25,327 @@ using custom_unique_ptr = std::unique_ptr<T, deleter_from_fn<fn>>;
 
 using archive_ptr = custom_unique_ptr<archive, archive_read_free>;
 
+// entries at least this large are shown while they are read, in a handful of steps
+constexpr la_int64_t progressive_entry_size = 4 * 1024 * 1024;
+constexpr la_int64_t progressive_steps = 6;
+
+// Read a RAR5 variable length integer, 7 bits per byte with the high bit set on all but the last
+static std::optional<uint64_t> readRarVint(const QByteArray &data, int &pos)
+{
+	uint64_t value = 0;
+	for (int shift = 0; pos < data.size() && shift < 64; shift += 7)
+	{
+		auto byte = static_cast<uint8_t>(data[pos++]);
+		value |= uint64_t{byte & 0x7fu} << shift;
+		if (!(byte & 0x80))
+			return value;
+	}
+
+	return std::nullopt;
+}
+
+// RAR archives say in their main header whether they were created solid. Archives whose header
+// can't be read, e.g. self extracting ones, are assumed to be.
+static bool isSolidRar(const QString &file_path)
+{
+	const auto rar4_signature = QByteArray::fromRawData("Rar!\x1A\x07\x00", 7);
+	const auto rar5_signature = QByteArray::fromRawData("Rar!\x1A\x07\x01\x00", 8);
+
+	QFile file(file_path);
+	if (!file.open(QIODevice::ReadOnly))
+		return true;
+
+	auto header = file.read(64);
+
+	// RAR 4: CRC16, type, flags and size of the main header follow the signature
+	if (header.startsWith(rar4_signature))
+	{
+		constexpr auto main_header_type = 0x73;
+		constexpr auto solid_flag = 0x0008;
+
+		auto pos = rar4_signature.size();
+		if (header.size() < pos + 5 || static_cast<uint8_t>(header[pos + 2]) != main_header_type)
+			return true;
+
+		auto flags = static_cast<uint8_t>(header[pos + 3]) | static_cast<uint8_t>(header[pos + 4]) << 8;
+		return (flags & solid_flag) != 0;
+	}
+
+	// RAR 5: CRC32, then the main header as vints: size, type, flags, optional extra and data
+	// sizes, and the archive flags
+	if (header.startsWith(rar5_signature))
+	{
+		constexpr auto main_header_type = 1;
+		constexpr auto extra_area_flag = 0x0001;
+		constexpr auto data_area_flag = 0x0002;
+		constexpr auto solid_flag = 0x0004;
+
+		auto pos = rar5_signature.size() + 4;
+		auto size = readRarVint(header, pos);
+		auto type = readRarVint(header, pos);
+		auto flags = readRarVint(header, pos);
+		if (!size || !type || !flags || *type != main_header_type)
+			return true;
+
+		if ((*flags & extra_area_flag) && !readRarVint(header, pos))
+			return true;
+
+		if ((*flags & data_area_flag) && !readRarVint(header, pos))
+			return true;
+
+		auto archiveFlags = readRarVint(header, pos);
+		return !archiveFlags || (*archiveFlags & solid_flag) != 0;
+	}
+
+	return true;
+}
+
+// Formats where reaching an entry means decompressing everything before it
+static bool isSolid(archive *archive, const QString &file_path)
+{
+	switch (archive_format(archive))
+	{
+	case ARCHIVE_FORMAT_RAR:
+	case ARCHIVE_FORMAT_RAR_V5:
+		return isSolidRar(file_path);
+
+	case ARCHIVE_FORMAT_7ZIP:
+		// solid blocks are only described in the header, which 7-Zip compresses by default and
+		// libarchive doesn't expose. Archives are created solid unless asked otherwise.
+		return true;
+
+	case ARCHIVE_FORMAT_TAR:
+	case ARCHIVE_FORMAT_TAR_USTAR:
+	case ARCHIVE_FORMAT_TAR_PAX_INTERCHANGE:
+	case ARCHIVE_FORMAT_TAR_PAX_RESTRICTED:
+	case ARCHIVE_FORMAT_TAR_GNUTAR:
+		// a compressed tarball is one long stream
+		return archive_filter_code(archive, 0) != ARCHIVE_FILTER_NONE;
+
+	default:
+		return false;
+	}
+}
+
+// Lowers the priority of the current pool thread for as long as it is in scope
+class BackgroundPriority final
+{
+public:
+	explicit BackgroundPriority(bool enabled) noexcept : enabled(enabled)
+	{
+		if (enabled)
+			QThread::currentThread()->setPriority(QThread::LowestPriority);
+	}
+
+	~BackgroundPriority()
+	{
+		if (enabled)
+			QThread::currentThread()->setPriority(QThread::NormalPriority);
+	}
+
+	BackgroundPriority(const BackgroundPriority &) = delete;
+	BackgroundPriority &operator=(const BackgroundPriority &) = delete;
+	BackgroundPriority(BackgroundPriority &&) = delete;
+	BackgroundPriority &operator=(BackgroundPriority &&) = delete;
+
+private:
+	bool enabled;
+};
+
+static archive_ptr openArchive(const QString &file_path)
+{
+	auto archive = archive_ptr{archive_read_new()};
+	archive_read_support_filter_all(archive.get());
+	archive_read_support_format_all(archive.get());
+
+	// no idea what is a good size, so use 4k
+	constexpr size_t block_size = 1024 * 4;
+	if (archive_read_open_filename(archive.get(), file_path.toUtf8().data(), block_size) != ARCHIVE_OK)
+		return nullptr;
+
+	return archive;
+}
+
+static bool isImageName(const QMimeDatabase &mimedb, const QString &filename)
+{
+	return mimedb.mimeTypeForFile(filename, QMimeDatabase::MatchExtension).name().startsWith("image/");
+}
+
+QStringList archiveNameFilters()
+{
+	return {"*.zip", "*.rar", "*.7z", "*.tar.gz", "*.tar.bz2"};
+}
+
+std::optional<ArchiveCover> readCover(const QString &file_path, const stop_token &token) noexcept
+{
+	QMimeDatabase mimedb;
+
+	if (auto cache = RepackCache::open(file_path))
+	{
+		std::optional<Entry> cover;
+		for (auto &&item : cache->entries())
+		{
+			if (isImageName(mimedb, item.filename) && (!cover || item.filename < cover->filename))
+				cover = item;
+		}
+
+		if (!cover)
+			return std::nullopt;
+
+		return ArchiveCover{.pages = cache->entries().size(), .entry = *cover, .content = cache->read(cover->index)};
+	}
+
+	// the same two passes as a full read, but only the cover is extracted
+	std::optional<Entry> cover;
+	auto pages = 0;
+
+	{
+		auto archive = openArchive(file_path);
+		if (!archive)
+			return std::nullopt;
+
+		archive_entry *entry = nullptr;
+		uint32_t index = 0;
+		while (!token.stop_requested() && archive_read_next_header(archive.get(), &entry) == ARCHIVE_OK)
+		{
+			if (archive_entry_filetype(entry) == AE_IFDIR)
+				continue;
+
+			auto filename = QString::fromUtf8(archive_entry_pathname(entry));
+			if (isImageName(mimedb, filename) && (!cover || filename < cover->filename))
+				cover = Entry{index, filename};
+
+			++pages;
+			++index;
+		}
+	}
+
+	if (!cover || token.stop_requested())
+		return std::nullopt;
+
+	auto archive = openArchive(file_path);
+	if (!archive)
+		return std::nullopt;
+
+	archive_entry *entry = nullptr;
+	uint32_t index = 0;
+	while (!token.stop_requested() && archive_read_next_header(archive.get(), &entry) == ARCHIVE_OK)
+	{
+		if (archive_entry_filetype(entry) == AE_IFDIR)
+			continue;
+
+		if (index++ != cover->index)
+			continue;
+
+		QByteArray content;
+		const void *buf;
+		size_t size;
+		la_int64_t offset;
+
+		while (archive_read_data_block(archive.get(), &buf, &size, &offset) == ARCHIVE_OK)
+			content.append(static_cast<const char *>(buf), int(size));
+
+		return ArchiveCover{.pages = pages, .entry = *cover, .content = std::move(content)};
+	}
+
+	return std::nullopt;
+}
+
+void WaitingEntries::add(uint32_t index) noexcept
+{
+	std::lock_guard lock(mutex);
+	entries.insert(index);
+}
+
+void WaitingEntries::remove(uint32_t index) noexcept
+{
+	std::lock_guard lock(mutex);
+	entries.remove(index);
+}
+
+bool WaitingEntries::contains(uint32_t index) const noexcept
+{
+	std::lock_guard lock(mutex);
+	return entries.contains(index);
+}
+
 ReadArchiveWorker::ReadArchiveWorker(QString file_path, stop_token token) noexcept : file_path(std::move(file_path)), token(std::move(token))
 {
 }
 
+void ReadArchiveWorker::setEntryLimit(int limit) noexcept
+{
+	entryLimit = limit;
+}
+
+void ReadArchiveWorker::setBackground(bool enabled) noexcept
+{
+	background = enabled;
+}
+
+void ReadArchiveWorker::setWanted(QVector<uint32_t> indices) noexcept
+{
+	wanted = std::move(indices);
+}
+
+void ReadArchiveWorker::setRepack(bool enabled) noexcept
+{
+	repack = enabled;
+}
+
+void ReadArchiveWorker::setProgressive(std::shared_ptr<const WaitingEntries> waitingEntries) noexcept
+{
+	waiting = std::move(waitingEntries);
+}
+
+bool ReadArchiveWorker::isWanted(uint32_t index) const noexcept
+{
+	return wanted.isEmpty() || wanted.contains(index);
+}
+
+void ReadArchiveWorker::readFromCache(RepackCache &cache)
+{
+	LOG_DEBUG("Reading '{0}' from the repack cache", file_path.toStdString());
+
+	QMimeDatabase mimedb;
+
+	if (wanted.isEmpty())
+		emit contents(cache.entries());
+
+	for (auto &&item : cache.entries())
+	{
+		if (token.stop_requested() || (entryLimit >= 0 && item.index >= uint32_t(entryLimit)))
+			break;
+
+		if (!isWanted(item.index))
+			continue;
+
+		auto content = cache.read(item.index);
+		auto mimeType = mimedb.mimeTypeForFileNameAndData(item.filename, content);
+
+		emit entryReady(item, {.type = mimeType, .content = std::move(content)});
+	}
+}
+
 void ReadArchiveWorker::run()
 {
+	BackgroundPriority priority(background);
+
+	// a repacked archive can go straight to any entry
+	if (auto cache = RepackCache::open(file_path))
+	{
+		readFromCache(*cache);
+		return;
+	}
+
 	QMimeDatabase mimedb;
 	QVector<Entry> entries;
 
 	// libarchive seems to be stream oriented and doesn't seem to support getting the entries or backtracking. So we will
 	// open the file twice, once to get the list of entries and prepare the view, and a second time to extract the items.
 
-	// Pass #1: Get the entries
+	// Pass #1: Get the entries, not needed when only fetching specific entries again
+	if (wanted.isEmpty())
 	{
 		auto archive = archive_ptr{archive_read_new()};
 		auto err = archive_read_support_filter_all(archive.get());
@@ -104,15 +417,41 @@ void ReadArchiveWorker::run()
 		if (err != ARCHIVE_OK)
 			emit error(tr("Error opening archive '%1'").arg(file_path));
 
+		// only a full read can produce a complete repack
+		std::optional<RepackWriter> writer;
+		auto canRepack = repack && wanted.isEmpty() && entryLimit < 0;
+
 		LOG_DEBUG("Begin extracting files");
 		archive_entry *entry = nullptr;
 		uint32_t index = 0;
-		while (!token.stop_requested() && archive_read_next_header(archive.get(), &entry) == ARCHIVE_OK)
+		auto remaining = wanted.size();
+		while (!token.stop_requested() && (err = archive_read_next_header(archive.get(), &entry)) == ARCHIVE_OK)
 		{
+			if (entryLimit >= 0 && index >= uint32_t(entryLimit))
+				break;
+
+			// everything asked for has been delivered, the rest of the archive isn't needed
+			if (!wanted.isEmpty() && remaining == 0)
+				break;
+
 			if (archive_entry_filetype(entry) == AE_IFDIR)
 				continue;
 
-			auto &item = entries[index];
+			// the format is only known once the first header is read
+			if (canRepack && !writer && index == 0 && isSolid(archive.get(), file_path))
+			{
+				LOG_DEBUG("Repacking solid archive '{0}'", file_path.toStdString());
+				writer.emplace(file_path);
+			}
+
+			if (!isWanted(index))
+			{
+				archive_read_data_skip(archive.get());
+				++index;
+				continue;
+			}
+
+			auto item = Entry{index, QString::fromUtf8(archive_entry_pathname(entry))};
 			LOG_DEBUG("Extracting #{0}: '{1}'", item.index, item.filename.toStdString());
 
 			QByteArray content;
@@ -120,6 +459,13 @@ void ReadArchiveWorker::run()
 			size_t size;
 			la_int64_t offset;
 
+			auto total = archive_entry_size_is_set(entry) ? archive_entry_size(entry) : 0;
+			if (total > 0 && total < std::numeric_limits<int>::max())
+				content.reserve(int(total));
+
+			auto step = total / progressive_steps;
+			auto nextProgress = waiting && total >= progressive_entry_size ? step : std::numeric_limits<la_int64_t>::max();
+
 			while (archive_read_data_block(archive.get(), &buf, &size, &offset) == ARCHIVE_OK)
 			{
 				LOG_TRACE("reading, size: {0}, off: {1}", size, offset);
@@ -127,13 +473,33 @@ void ReadArchiveWorker::run()
 					LOG_WARN("Offset mismatch: expected {0}, got {1}", content.size(), offset);
 
 				content.append(static_cast<const char *>(buf), int(size));
+
+				if (content.size() >= nextProgress && content.size() < total && !token.stop_requested())
+				{
+					// the view can start waiting on the entry partway through
+					if (waiting->contains(item.index))
+					{
+						LOG_TRACE("#{0}: {1} of {2} bytes read", item.index, content.size(), total);
+						emit entryProgress(item, content);
+					}
+					nextProgress += step;
+				}
 			}
 
+			if (writer)
+				writer->add(item, content);
+
 			auto mimeType = mimedb.mimeTypeForFileNameAndData(item.filename, content);
 
 			emit entryReady(item, {.type = mimeType, .content = std::move(content)});
 			++index;
+
+			if (!wanted.isEmpty())
+				--remaining;
 		}
 		LOG_DEBUG("Finished extracting files");
+
+		if (writer && !token.stop_requested() && err == ARCHIVE_EOF)
+			writer->commit();
 	}
 }
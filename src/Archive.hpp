@@ -3,11 +3,17 @@
 #include <QByteArray>
 #include <QMimeType>
 #include <QObject>
+#include <QPair>
 #include <QRunnable>
+#include <QSet>
 #include <QString>
+#include <QStringList>
 #include <QVector>
 
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <version>
 
 #if defined(__cpp_lib_jthread)
@@ -17,6 +23,22 @@ using std::stop_token;
 #	include "stop_source.hpp"
 #endif
 
+class RepackCache;
+
+// The entries a view is waiting to show, shared with the workers reading them. Safe to use from
+// any thread.
+class WaitingEntries final
+{
+public:
+	void add(uint32_t index) noexcept;
+	void remove(uint32_t index) noexcept;
+	bool contains(uint32_t index) const noexcept;
+
+private:
+	mutable std::mutex mutex;
+	QSet<uint32_t> entries;
+};
+
 struct Entry
 {
 	uint32_t index;
@@ -29,6 +51,27 @@ struct EntryData
 	QByteArray content;
 };
 
+// The entries and first few pages of an archive, read before it is opened
+struct PrefetchedArchive
+{
+	QString path;
+	QVector<Entry> entries;
+	QVector<QPair<Entry, EntryData>> pages;
+};
+
+// The page a library shows for an archive, the first image in name order
+struct ArchiveCover
+{
+	int pages;
+	Entry entry;
+	QByteArray content;
+};
+
+// File name patterns of the archives that can be opened
+QStringList archiveNameFilters();
+
+std::optional<ArchiveCover> readCover(const QString &file_path, const stop_token &token) noexcept;
+
 Q_DECLARE_METATYPE(Entry);
 Q_DECLARE_METATYPE(EntryData);
 
@@ -39,15 +82,39 @@ class ReadArchiveWorker final : public QObject, public QRunnable
 public:
 	ReadArchiveWorker(QString file_path, stop_token token) noexcept;
 
+	// Stop after extracting this many entries
+	void setEntryLimit(int limit) noexcept;
+
+	// Run at a lower thread priority so as not to compete with the archives being read
+	void setBackground(bool background) noexcept;
+
+	// Only extract these entries, without listing the archive first
+	void setWanted(QVector<uint32_t> indices) noexcept;
+
+	// Keep solid archives in the repack cache after reading them in full
+	void setRepack(bool repack) noexcept;
+
+	// Report what has been read of large entries while they are still being extracted, for the
+	// ones that are waited on. Copying out the partial bytes isn't free, so others aren't reported.
+	void setProgressive(std::shared_ptr<const WaitingEntries> waitingEntries) noexcept;
+
 private:
 	void run() override;
+	void readFromCache(RepackCache &cache);
+	bool isWanted(uint32_t index) const noexcept;
 
 signals:
 	void error(QString msg);
 	void contents(QVector<Entry> entries);
 	void entryReady(Entry entry, EntryData data);
+	void entryProgress(Entry entry, QByteArray partial);
 
 private:
 	QString file_path;
 	stop_token token;
+	QVector<uint32_t> wanted;
+	int entryLimit = -1;
+	bool background = false;
+	bool repack = false;
+	std::shared_ptr<const WaitingEntries> waiting;
 };
@@ -0,0 +1,102 @@
+#include "ArchivePrefetch.hpp"
+
+#include <QThreadPool>
+
+#include <utility>
+
+#include "log.hpp"
+
+// enough pages to show the start of the next archive while the rest is extracted
+constexpr auto prefetch_pages = 8;
+
+// queued behind anything the open tabs are waiting on
+constexpr auto prefetch_priority = -1;
+
+ArchivePrefetch::ArchivePrefetch(QObject *parent) noexcept : QObject(parent)
+{
+	MemoryBudget::instance().registerClient(this);
+}
+
+ArchivePrefetch::~ArchivePrefetch()
+{
+	cancellationSource.request_stop();
+	MemoryBudget::instance().unregisterClient(this);
+}
+
+void ArchivePrefetch::prefetch(const QString &path) noexcept
+{
+	if (isPrefetched(path))
+		return;
+
+	clear();
+
+	LOG_INFO("Prefetching '{0}'", path.toStdString());
+
+	archive = PrefetchedArchive{.path = path, .entries = {}, .pages = {}};
+	auto current = ++generation;
+
+	auto worker = new ReadArchiveWorker(path, cancellationSource.get_token());
+	worker->setEntryLimit(prefetch_pages);
+	worker->setBackground(true);
+
+	connect(
+		worker, &ReadArchiveWorker::error, this, [](QString msg) { LOG_WARN("Prefetch error: {0}", msg.toStdString()); }, Qt::QueuedConnection);
+
+	connect(
+		worker, &ReadArchiveWorker::contents, this,
+		[this, current](QVector<Entry> entries) {
+			if (current == generation && archive)
+				archive->entries = std::move(entries);
+		},
+		Qt::QueuedConnection);
+
+	connect(
+		worker, &ReadArchiveWorker::entryReady, this,
+		[this, current](Entry entry, EntryData entryData) {
+			if (current != generation || !archive)
+				return;
+
+			encodedBytes += entryData.content.size();
+			MemoryBudget::instance().charge(this, MemoryCategory::Encoded, entryData.content.size());
+			archive->pages.push_back({std::move(entry), std::move(entryData)});
+		},
+		Qt::QueuedConnection);
+
+	QThreadPool::globalInstance()->start(worker, prefetch_priority);
+}
+
+bool ArchivePrefetch::isPrefetched(const QString &path) const noexcept
+{
+	return archive && archive->path == path;
+}
+
+std::optional<PrefetchedArchive> ArchivePrefetch::take(const QString &path) noexcept
+{
+	if (!isPrefetched(path) || archive->entries.isEmpty())
+		return std::nullopt;
+
+	auto result = std::move(archive);
+	clear();
+	return result;
+}
+
+void ArchivePrefetch::trimMemory(MemoryCategory category, [[maybe_unused]] bool keepWorkingSet) noexcept
+{
+	if (category != MemoryCategory::Encoded || !archive)
+		return;
+
+	// the entry list is tiny and still lets the tab fill in its page list right away
+	LOG_DEBUG("Dropping prefetched pages of '{0}'", archive->path.toStdString());
+	archive->pages.clear();
+	MemoryBudget::instance().release(this, MemoryCategory::Encoded, std::exchange(encodedBytes, 0));
+}
+
+void ArchivePrefetch::clear() noexcept
+{
+	cancellationSource.request_stop();
+	cancellationSource = stop_source{};
+	++generation;
+
+	archive.reset();
+	MemoryBudget::instance().release(this, MemoryCategory::Encoded, std::exchange(encodedBytes, 0));
+}
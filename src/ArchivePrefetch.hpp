@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+
+#include <optional>
+#include <version>
+
+#if defined(__cpp_lib_jthread)
+#	include <stop_token>
+using std::stop_source;
+#else
+#	include "stop_source.hpp"
+#endif
+
+#include "Archive.hpp"
+#include "MemoryBudget.hpp"
+
+// Reads the entries and first pages of an archive at low priority so that opening it later is
+// instant. Only one archive is held at a time and its pages are the first thing to go when the
+// memory budget runs out.
+class ArchivePrefetch final : public QObject, public MemoryClient
+{
+	Q_OBJECT
+
+public:
+	explicit ArchivePrefetch(QObject *parent = nullptr) noexcept;
+	~ArchivePrefetch() override;
+
+	ArchivePrefetch(const ArchivePrefetch &) = delete;
+	ArchivePrefetch &operator=(const ArchivePrefetch &) = delete;
+	ArchivePrefetch(ArchivePrefetch &&) = delete;
+	ArchivePrefetch &operator=(ArchivePrefetch &&) = delete;
+
+	void prefetch(const QString &path) noexcept;
+	bool isPrefetched(const QString &path) const noexcept;
+
+	// Hand over what has been read so far, if anything
+	std::optional<PrefetchedArchive> take(const QString &path) noexcept;
+
+	void trimMemory(MemoryCategory category, bool keepWorkingSet) noexcept override;
+
+private:
+	void clear() noexcept;
+
+private:
+	std::optional<PrefetchedArchive> archive;
+	int64_t encodedBytes = 0;
+	int generation = 0;
+
+	stop_source cancellationSource;
+};
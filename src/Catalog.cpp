@@ -0,0 +1,333 @@
+#include "Catalog.hpp"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSet>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStandardPaths>
+#include <QThread>
+#include <QTimer>
+#include <QVariant>
+
+#include <algorithm>
+#include <utility>
+
+#include "Archive.hpp"
+#include "Decoder.hpp"
+#include "log.hpp"
+
+constexpr auto connection_name = "catalog";
+
+// changed archives are handed over in batches so the GUI thread sees few, small updates
+constexpr auto scan_batch_size = 64;
+
+constexpr auto flush_interval = 250;
+
+constexpr auto cover_width = 160;
+constexpr auto cover_height = 240;
+constexpr auto cover_quality = 85;
+
+static QSqlDatabase database()
+{
+	return QSqlDatabase::database(connection_name);
+}
+
+CatalogScanWorker::CatalogScanWorker(QString folder, KnownArchives known, stop_token token) noexcept
+	: folder(std::move(folder)), known(std::move(known)), token(std::move(token))
+{
+}
+
+void CatalogScanWorker::run()
+{
+	LOG_DEBUG("Scanning '{0}'", folder.toStdString());
+
+	QStringList batch;
+	QSet<QString> seen;
+
+	QDirIterator it(folder, archiveNameFilters(), QDir::Files, QDirIterator::Subdirectories);
+	while (it.hasNext() && !token.stop_requested())
+	{
+		auto path = it.next();
+		auto info = it.fileInfo();
+		seen.insert(path);
+
+		auto knownIt = known.constFind(path);
+		if (knownIt != known.constEnd() && knownIt->first == info.size() && knownIt->second == info.lastModified().toMSecsSinceEpoch())
+			continue;
+
+		batch.push_back(path);
+		if (batch.size() >= scan_batch_size)
+			emit changed(std::exchange(batch, {}));
+	}
+
+	if (token.stop_requested())
+		return;
+
+	if (!batch.isEmpty())
+		emit changed(batch);
+
+	QStringList gone;
+	auto prefix = folder + '/';
+	for (auto knownIt = known.constBegin(); knownIt != known.constEnd(); ++knownIt)
+	{
+		if (knownIt.key().startsWith(prefix) && !seen.contains(knownIt.key()))
+			gone.push_back(knownIt.key());
+	}
+
+	if (!gone.isEmpty())
+		emit missing(gone);
+
+	LOG_DEBUG("Finished scanning '{0}', {1} archives", folder.toStdString(), seen.size());
+}
+
+CoverWorker::CoverWorker(QString path, stop_token token) noexcept : path(std::move(path)), token(std::move(token))
+{
+}
+
+void CoverWorker::run()
+{
+	if (token.stop_requested())
+		return;
+
+	auto info = QFileInfo(path);
+	auto record = CatalogRecord{.path = path, .size = info.size(), .modified = info.lastModified().toMSecsSinceEpoch(), .pages = 0, .cover = {}};
+
+	if (auto cover = readCover(path, token))
+	{
+		record.pages = cover->pages;
+
+		auto decoded = decodeImage(cover->content, {cover_width, cover_height}, Qt::KeepAspectRatio);
+		if (!decoded.image.isNull())
+		{
+			QBuffer buffer(&record.cover);
+			buffer.open(QIODevice::WriteOnly);
+			decoded.image.save(&buffer, "JPG", cover_quality);
+		}
+	}
+
+	if (!token.stop_requested())
+		emit ready(std::move(record));
+}
+
+Catalog::Catalog(QObject *parent) noexcept : QObject(parent), flushTimer(new QTimer(this))
+{
+	auto dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+	QDir().mkpath(dir);
+
+	auto db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
+	db.setDatabaseName(QDir(dir).filePath("catalog.sqlite"));
+	if (!db.open())
+		LOG_ERROR("Could not open catalog: {0}", db.lastError().text().toStdString());
+
+	QSqlQuery query(db);
+	query.exec("CREATE TABLE IF NOT EXISTS folders (path TEXT PRIMARY KEY)");
+	query.exec("CREATE TABLE IF NOT EXISTS archives (path TEXT PRIMARY KEY, size INTEGER NOT NULL, modified INTEGER NOT NULL, pages INTEGER NOT NULL, cover BLOB)");
+
+	flushTimer->setInterval(flush_interval);
+	flushTimer->setSingleShot(true);
+	connect(flushTimer, &QTimer::timeout, this, &Catalog::flush);
+
+	coverPool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() / 2));
+}
+
+Catalog::~Catalog()
+{
+	cancellationSource.request_stop();
+	coverPool.clear();
+	coverPool.waitForDone();
+
+	flush();
+
+	database().close();
+	QSqlDatabase::removeDatabase(connection_name);
+}
+
+QStringList Catalog::folders() const noexcept
+{
+	QStringList result;
+
+	QSqlQuery query("SELECT path FROM folders ORDER BY path", database());
+	while (query.next())
+		result.push_back(query.value(0).toString());
+
+	return result;
+}
+
+void Catalog::addFolder(const QString &folder) noexcept
+{
+	QSqlQuery query(database());
+	query.prepare("INSERT OR IGNORE INTO folders (path) VALUES (?)");
+	query.addBindValue(QDir(folder).absolutePath());
+	if (!query.exec())
+		LOG_WARN("Could not add library folder: {0}", query.lastError().text().toStdString());
+
+	rescan();
+}
+
+QVector<CatalogRecord> Catalog::records() const noexcept
+{
+	QVector<CatalogRecord> result;
+
+	QSqlQuery query(database());
+	query.setForwardOnly(true);
+	query.exec("SELECT path, size, modified, pages FROM archives ORDER BY path");
+	while (query.next())
+	{
+		result.push_back({.path = query.value(0).toString(),
+			.size = query.value(1).toLongLong(),
+			.modified = query.value(2).toLongLong(),
+			.pages = query.value(3).toInt(),
+			.cover = {}});
+	}
+
+	return result;
+}
+
+QByteArray Catalog::cover(const QString &path) const noexcept
+{
+	auto it = pending.constFind(path);
+	if (it != pending.constEnd())
+		return it->cover;
+
+	QSqlQuery query(database());
+	query.prepare("SELECT cover FROM archives WHERE path = ?");
+	query.addBindValue(path);
+	if (query.exec() && query.next())
+		return query.value(0).toByteArray();
+
+	return {};
+}
+
+void Catalog::rescan() noexcept
+{
+	if (isScanning())
+		return;
+
+	auto known = knownArchives();
+	coversQueued = coversRead = 0;
+
+	for (auto &&folder : folders())
+	{
+		auto worker = new CatalogScanWorker(folder, known, cancellationSource.get_token());
+		++scansRunning;
+
+		connect(worker, &CatalogScanWorker::changed, this, &Catalog::readCovers, Qt::QueuedConnection);
+		connect(worker, &CatalogScanWorker::missing, this, &Catalog::remove, Qt::QueuedConnection);
+		connect(worker, &CatalogScanWorker::destroyed, this, [this] {
+			--scansRunning;
+			checkFinished();
+		});
+
+		// walking the folders is mostly waiting on the disk, so each tree gets its own thread
+		QThreadPool::globalInstance()->start(worker);
+	}
+}
+
+bool Catalog::isScanning() const noexcept
+{
+	return scansRunning > 0 || coversRead < coversQueued;
+}
+
+KnownArchives Catalog::knownArchives() const noexcept
+{
+	KnownArchives result;
+
+	QSqlQuery query(database());
+	query.setForwardOnly(true);
+	query.exec("SELECT path, size, modified FROM archives");
+	while (query.next())
+		result.insert(query.value(0).toString(), {query.value(1).toLongLong(), query.value(2).toLongLong()});
+
+	return result;
+}
+
+void Catalog::readCovers(const QStringList &paths) noexcept
+{
+	for (auto &&path : paths)
+	{
+		auto worker = new CoverWorker(path, cancellationSource.get_token());
+		++coversQueued;
+
+		connect(
+			worker, &CoverWorker::ready, this,
+			[this](CatalogRecord record) {
+				++coversRead;
+				emit scanProgress(coversRead, coversQueued);
+
+				pending.insert(record.path, record);
+				if (!flushTimer->isActive())
+					flushTimer->start();
+
+				checkFinished();
+			},
+			Qt::QueuedConnection);
+
+		coverPool.start(worker);
+	}
+
+	emit scanProgress(coversRead, coversQueued);
+}
+
+void Catalog::remove(const QStringList &paths) noexcept
+{
+	auto db = database();
+	db.transaction();
+
+	QSqlQuery query(db);
+	query.prepare("DELETE FROM archives WHERE path = ?");
+	for (auto &&path : paths)
+	{
+		pending.remove(path);
+		query.addBindValue(path);
+		query.exec();
+		emit recordRemoved(path);
+	}
+
+	db.commit();
+}
+
+void Catalog::checkFinished() noexcept
+{
+	if (!isScanning())
+	{
+		flush();
+		emit scanFinished();
+	}
+}
+
+void Catalog::flush() noexcept
+{
+	if (pending.isEmpty())
+		return;
+
+	auto db = database();
+	db.transaction();
+
+	QVector<CatalogRecord> updated;
+	updated.reserve(pending.size());
+
+	QSqlQuery query(db);
+	query.prepare("INSERT OR REPLACE INTO archives (path, size, modified, pages, cover) VALUES (?, ?, ?, ?, ?)");
+	for (auto &&record : std::as_const(pending))
+	{
+		updated.push_back({.path = record.path, .size = record.size, .modified = record.modified, .pages = record.pages, .cover = {}});
+
+		query.addBindValue(record.path);
+		query.addBindValue(record.size);
+		query.addBindValue(record.modified);
+		query.addBindValue(record.pages);
+		query.addBindValue(record.cover);
+		if (!query.exec())
+			LOG_WARN("Could not catalog '{0}': {1}", record.path.toStdString(), query.lastError().text().toStdString());
+	}
+
+	db.commit();
+	pending.clear();
+
+	emit recordsUpdated(updated);
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QPair>
+#include <QRunnable>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <version>
+
+#if defined(__cpp_lib_jthread)
+#	include <stop_token>
+using std::stop_source;
+using std::stop_token;
+#else
+#	include "stop_source.hpp"
+#endif
+
+class QTimer;
+
+struct CatalogRecord
+{
+	QString path;
+	qint64 size = 0;
+	qint64 modified = 0;
+	int pages = 0;
+	QByteArray cover;
+};
+
+Q_DECLARE_METATYPE(CatalogRecord);
+
+// size and modification time of each archive already in the catalog, by path
+using KnownArchives = QHash<QString, QPair<qint64, qint64>>;
+
+// Walks a folder tree and reports archives that are new or changed since they were catalogued,
+// and catalogued archives that are gone. Unchanged archives are only stat'ed.
+class CatalogScanWorker final : public QObject, public QRunnable
+{
+	Q_OBJECT
+
+public:
+	CatalogScanWorker(QString folder, KnownArchives known, stop_token token) noexcept;
+
+private:
+	void run() override;
+
+signals:
+	void changed(QStringList paths);
+	void missing(QStringList paths);
+
+private:
+	QString folder;
+	KnownArchives known;
+	stop_token token;
+};
+
+// Reads the cover and page count of a single archive
+class CoverWorker final : public QObject, public QRunnable
+{
+	Q_OBJECT
+
+public:
+	CoverWorker(QString path, stop_token token) noexcept;
+
+private:
+	void run() override;
+
+signals:
+	void ready(CatalogRecord record);
+
+private:
+	QString path;
+	stop_token token;
+};
+
+// The archives found in the library folders, kept in a database so that the library can be shown
+// straight away and rescans only need to look at archives that changed. Writes are batched so
+// that a scan doesn't hold up the GUI thread.
+class Catalog final : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit Catalog(QObject *parent = nullptr) noexcept;
+	~Catalog() override;
+
+	Catalog(const Catalog &) = delete;
+	Catalog &operator=(const Catalog &) = delete;
+	Catalog(Catalog &&) = delete;
+	Catalog &operator=(Catalog &&) = delete;
+
+	QStringList folders() const noexcept;
+	void addFolder(const QString &folder) noexcept;
+
+	// every catalogued archive ordered by path, without covers
+	QVector<CatalogRecord> records() const noexcept;
+	QByteArray cover(const QString &path) const noexcept;
+
+	void rescan() noexcept;
+	bool isScanning() const noexcept;
+
+signals:
+	// Once per batch written to the database, without covers
+	void recordsUpdated(const QVector<CatalogRecord> &records);
+	void recordRemoved(const QString &path);
+	void scanProgress(int completed, int total);
+	void scanFinished();
+
+private:
+	KnownArchives knownArchives() const noexcept;
+	void readCovers(const QStringList &paths) noexcept;
+	void remove(const QStringList &paths) noexcept;
+	void checkFinished() noexcept;
+	void flush() noexcept;
+
+private:
+	QHash<QString, CatalogRecord> pending;
+	QTimer *flushTimer;
+
+	// covers are read on their own pool so a scan never queues ahead of pages being viewed
+	QThreadPool coverPool;
+	stop_source cancellationSource;
+
+	int scansRunning = 0;
+	int coversQueued = 0;
+	int coversRead = 0;
+};
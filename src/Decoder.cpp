@@ -0,0 +1,186 @@
+#include "Decoder.hpp"
+
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QImageReader>
+
+#include <cstdlib>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define HAVE_SSE2
+#	include <emmintrin.h>
+#endif
+
+#include "NativeDecoder.hpp"
+#include "log.hpp"
+
+// how far apart the channels of a pixel may be for it to count as gray, which lets chroma noise
+// in scanned and jpeg compressed pages through
+constexpr auto gray_tolerance = 6;
+
+// Whether every pixel in a row of RGB32 pixels is gray
+static bool isGrayRow(const QRgb *row, int width) noexcept
+{
+	auto x = 0;
+
+#if defined(HAVE_SSE2)
+	// shifting each pixel down a byte lines up blue with green and green with red
+	const auto channels = _mm_set1_epi32(0x0000ffff);
+	const auto tolerance = _mm_set1_epi8(static_cast<char>(gray_tolerance));
+	const auto zero = _mm_setzero_si128();
+
+	for (; x + 4 <= width; x += 4)
+	{
+		auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+		auto shifted = _mm_srli_epi32(pixels, 8);
+		auto difference = _mm_or_si128(_mm_subs_epu8(pixels, shifted), _mm_subs_epu8(shifted, pixels));
+		auto excess = _mm_subs_epu8(_mm_and_si128(difference, channels), tolerance);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(excess, zero)) != 0xffff)
+			return false;
+	}
+#endif
+
+	for (; x < width; ++x)
+	{
+		auto pixel = row[x];
+		if (std::abs(qRed(pixel) - qGreen(pixel)) > gray_tolerance || std::abs(qGreen(pixel) - qBlue(pixel)) > gray_tolerance)
+			return false;
+	}
+
+	return true;
+}
+
+static bool isGrayscale(const QImage &image) noexcept
+{
+	for (int y = 0; y < image.height(); ++y)
+	{
+		if (!isGrayRow(reinterpret_cast<const QRgb *>(image.constScanLine(y)), image.width()))
+			return false;
+	}
+
+	return true;
+}
+
+QImage::Format displayFormat(bool hasAlpha) noexcept
+{
+	return hasAlpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+}
+
+QSize decodeSize(QSize original, QSize size, Qt::AspectRatioMode mode) noexcept
+{
+	if (!size.isValid())
+		return original;
+
+	auto target = original.scaled(size, mode);
+	if (mode != Qt::IgnoreAspectRatio && target.width() > original.width())
+		return original;
+
+	return target;
+}
+
+QImage finishImage(QImage image, QSize target) noexcept
+{
+	if (image.size() != target)
+		image = image.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+	// QImage keeps scanlines 32-bit aligned, so a 32 bpp display format can be handed to the paint
+	// engine as is. Converting here keeps that work off the GUI thread.
+	auto format = displayFormat(image.hasAlphaChannel());
+	if (image.format() != format && image.format() != QImage::Format_Grayscale8)
+		image = std::move(image).convertToFormat(format);
+
+	// Most manga and scanned text pages have no colour at all. As 8 bpp they take a quarter of the
+	// memory, and the paint engine expands them a scanline at a time while drawing.
+	if (image.format() == QImage::Format_RGB32 && isGrayscale(image))
+		image = std::move(image).convertToFormat(QImage::Format_Grayscale8);
+
+	return image;
+}
+
+DecodedImage decodeImage(const QByteArray &content, QSize size, Qt::AspectRatioMode mode) noexcept
+{
+	if (auto decoder = findNativeDecoder(content))
+	{
+		if (auto result = decoder->decode(content, size, mode))
+			return std::move(*result);
+
+		LOG_DEBUG("Falling back to Qt after {0} failed to decode image", decoder->name);
+	}
+
+	return decodeWithPlugins(content, size, mode);
+}
+
+DecodedImage decodePartialImage(const QByteArray &partial, QSize size, Qt::AspectRatioMode mode) noexcept
+{
+	// truncated jpeg files decode through either path, with missing scans or rows filled in
+	auto decoder = findNativeDecoder(partial);
+	if (!decoder || !decoder->decodePartial)
+		return decodeImage(partial, size, mode);
+
+	if (auto result = decoder->decodePartial(partial, size, mode))
+		return std::move(*result);
+
+	return {};
+}
+
+DecodedImage decodeWithPlugins(const QByteArray &content, QSize size, Qt::AspectRatioMode mode) noexcept
+{
+	QBuffer buffer;
+	buffer.setData(content);
+	buffer.open(QIODevice::ReadOnly);
+
+	QImageReader reader(&buffer);
+
+	DecodedImage result;
+	result.originalSize = reader.size();
+	result.animated = reader.supportsAnimation() && reader.imageCount() != 1;
+
+	// let the codec do the scaling where it can, e.g. jpeg can skip most of the work with a smaller DCT
+	if (size.isValid() && result.originalSize.isValid())
+		reader.setScaledSize(decodeSize(result.originalSize, size, mode));
+
+	if (!reader.read(&result.image))
+	{
+		LOG_DEBUG("Could not decode image: {0}", reader.errorString().toStdString());
+		return result;
+	}
+
+	// formats that don't report their size up front are only known once decoded
+	if (!result.originalSize.isValid())
+		result.originalSize = result.image.size();
+
+	result.image = finishImage(std::move(result.image), decodeSize(result.originalSize, size, mode));
+	return result;
+}
+
+DecodeWorker::DecodeWorker(QByteArray content, QSize size, Qt::AspectRatioMode mode, stop_token token) noexcept
+	: content(std::move(content)), size(size), mode(mode), token(std::move(token))
+{
+}
+
+void DecodeWorker::setPartial(bool enabled) noexcept
+{
+	partial = enabled;
+}
+
+void DecodeWorker::setOwner(std::shared_ptr<const void> contentOwner) noexcept
+{
+	owner = std::move(contentOwner);
+}
+
+void DecodeWorker::run()
+{
+	if (token.stop_requested())
+		return;
+
+	QElapsedTimer timer;
+	timer.start();
+
+	auto result = partial ? decodePartialImage(content, size, mode) : decodeImage(content, size, mode);
+
+	LOG_DEBUG("Decoded {0}x{1} {2}image in {3} ms", result.image.width(), result.image.height(), partial ? "partial " : "", timer.elapsed());
+
+	if (!token.stop_requested())
+		emit decoded(std::move(result));
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QObject>
+#include <QRunnable>
+#include <QSize>
+
+#include <memory>
+#include <version>
+
+#if defined(__cpp_lib_jthread)
+#	include <stop_token>
+using std::stop_token;
+#else
+#	include "stop_source.hpp"
+#endif
+
+struct DecodedImage
+{
+	QImage image;
+	QSize originalSize;
+	bool animated = false;
+};
+
+Q_DECLARE_METATYPE(DecodedImage);
+
+// The formats the raster paint engine draws straight from memory, without converting at paint time
+QImage::Format displayFormat(bool hasAlpha) noexcept;
+
+// The size an image of the given original size is decoded at, see decodeImage
+QSize decodeSize(QSize original, QSize size, Qt::AspectRatioMode mode) noexcept;
+
+// Scale a decoded image the rest of the way to the target size and convert it to the display format.
+// Images without colour become Format_Grayscale8 instead.
+QImage finishImage(QImage image, QSize target) noexcept;
+
+// Decode an image at the given size and convert it to the display format. With Qt::KeepAspectRatio, the
+// size is an upper bound and images are never scaled up. An invalid size decodes at the original size.
+//
+// Formats with a native decoder in this build skip Qt's image plugins, which remain the fallback.
+DecodedImage decodeImage(const QByteArray &content, QSize size, Qt::AspectRatioMode mode = Qt::IgnoreAspectRatio) noexcept;
+
+// Decode as much of an image as has been read so far, to show while the rest is on its way.
+// Progressive and interlaced images give a low resolution version of the whole image, others
+// the rows read so far.
+DecodedImage decodePartialImage(const QByteArray &partial, QSize size, Qt::AspectRatioMode mode = Qt::IgnoreAspectRatio) noexcept;
+
+// Same as decodeImage, but always through Qt's image plugins
+DecodedImage decodeWithPlugins(const QByteArray &content, QSize size, Qt::AspectRatioMode mode = Qt::IgnoreAspectRatio) noexcept;
+
+class DecodeWorker final : public QObject, public QRunnable
+{
+	Q_OBJECT
+
+public:
+	DecodeWorker(QByteArray content, QSize size, Qt::AspectRatioMode mode, stop_token token) noexcept;
+
+	// The content is only the start of the image, see decodePartialImage
+	void setPartial(bool partial) noexcept;
+
+	// Keep whatever the content points into alive until decoding is done, e.g. a mapped file
+	void setOwner(std::shared_ptr<const void> owner) noexcept;
+
+private:
+	void run() override;
+
+signals:
+	void decoded(DecodedImage result);
+
+private:
+	QByteArray content;
+	QSize size;
+	Qt::AspectRatioMode mode;
+	stop_token token;
+	bool partial = false;
+	std::shared_ptr<const void> owner;
+};
@@ -0,0 +1,158 @@
+#include "MemoryBudget.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#include "log.hpp"
+
+constexpr int64_t default_limit = int64_t{1536} * 1024 * 1024;
+
+static constexpr size_t slot(MemoryCategory category) noexcept
+{
+	return static_cast<size_t>(category);
+}
+
+MemoryBudget::MemoryBudget() noexcept : limitBytes(default_limit)
+{
+}
+
+MemoryBudget &MemoryBudget::instance() noexcept
+{
+	static MemoryBudget budget;
+	return budget;
+}
+
+int64_t MemoryBudget::limit() const noexcept
+{
+	return limitBytes;
+}
+
+void MemoryBudget::setLimit(int64_t bytes) noexcept
+{
+	LOG_INFO("Memory limit set to {} MiB", bytes / (1024 * 1024));
+	limitBytes = bytes;
+	enforce();
+
+	emit usageChanged(used(), limitBytes);
+}
+
+int64_t MemoryBudget::used() const noexcept
+{
+	return std::accumulate(totals.begin(), totals.end(), int64_t{0});
+}
+
+int64_t MemoryBudget::used(MemoryCategory category) const noexcept
+{
+	return totals[slot(category)];
+}
+
+MemoryBudget::ClientUsage *MemoryBudget::find(MemoryClient *client) noexcept
+{
+	auto it = std::find_if(clients.begin(), clients.end(), [client](const ClientUsage &usage) { return usage.client == client; });
+	if (it != clients.end())
+		return &*it;
+
+	return nullptr;
+}
+
+void MemoryBudget::registerClient(MemoryClient *client) noexcept
+{
+	if (!find(client))
+		clients.push_front({.client = client, .bytes = {}});
+}
+
+void MemoryBudget::unregisterClient(MemoryClient *client) noexcept
+{
+	auto usage = find(client);
+	if (!usage)
+		return;
+
+	for (size_t i = 0; i < totals.size(); ++i)
+		totals[i] -= usage->bytes[i];
+
+	clients.erase(clients.begin() + (usage - clients.data()));
+
+	if (active == client)
+		active = nullptr;
+
+	emit usageChanged(used(), limitBytes);
+}
+
+void MemoryBudget::setActive(MemoryClient *client) noexcept
+{
+	active = client;
+
+	auto usage = find(client);
+	if (!usage)
+		return;
+
+	// move to the back so background clients stay ordered by when they were last seen
+	auto moved = *usage;
+	clients.erase(clients.begin() + (usage - clients.data()));
+	clients.push_back(moved);
+
+	enforce();
+}
+
+void MemoryBudget::charge(MemoryClient *client, MemoryCategory category, int64_t bytes) noexcept
+{
+	auto usage = find(client);
+	if (!usage)
+	{
+		LOG_WARN("Charging {} bytes to unregistered client", bytes);
+		return;
+	}
+
+	usage->bytes[slot(category)] += bytes;
+	totals[slot(category)] += bytes;
+
+	enforce();
+
+	emit usageChanged(used(), limitBytes);
+}
+
+void MemoryBudget::release(MemoryClient *client, MemoryCategory category, int64_t bytes) noexcept
+{
+	auto usage = find(client);
+	if (!usage)
+		return;
+
+	usage->bytes[slot(category)] -= bytes;
+	totals[slot(category)] -= bytes;
+
+	emit usageChanged(used(), limitBytes);
+}
+
+void MemoryBudget::enforce() noexcept
+{
+	if (enforcing || used() <= limitBytes)
+		return;
+
+	enforcing = true;
+
+	LOG_DEBUG("Over memory budget: {0} of {1} bytes in use", used(), limitBytes);
+
+	// Decoded images can be rebuilt from the encoded bytes, so drop those first. Dropping the
+	// encoded bytes as well leaves a background client with nothing but its thumbnails.
+	for (auto category : {MemoryCategory::Decoded, MemoryCategory::Encoded})
+	{
+		for (int i = 0; i < clients.size() && used() > limitBytes; ++i)
+		{
+			auto &usage = clients[i];
+			if (usage.client != active && usage.bytes[slot(category)] > 0)
+				usage.client->trimMemory(category, false);
+		}
+	}
+
+	// the active client gives up what it isn't showing, its decoded images before its encoded bytes
+	for (auto category : {MemoryCategory::Decoded, MemoryCategory::Encoded})
+	{
+		if (used() > limitBytes && active)
+			active->trimMemory(category, true);
+	}
+
+	if (used() > limitBytes)
+		LOG_WARN("Unable to get under memory budget: {0} of {1} bytes in use", used(), limitBytes);
+
+	enforcing = false;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <QObject>
+#include <QVector>
+
+#include <array>
+#include <cstdint>
+
+enum class MemoryCategory
+{
+	Encoded,
+	Decoded,
+	Thumbnail,
+};
+
+// Anything that holds on to page data and can give it back when memory gets tight
+class MemoryClient
+{
+public:
+	virtual ~MemoryClient() = default;
+
+	// Drop everything held in the given category. When keepWorkingSet is set, only data
+	// outside of what is needed to display the current page should be released.
+	virtual void trimMemory(MemoryCategory category, bool keepWorkingSet) noexcept = 0;
+};
+
+// Process wide accounting of the memory used for pages across all open archives. When the
+// limit is exceeded, clients are asked to trim, least recently active first. The active
+// client is only ever asked to trim down to its working set.
+//
+// Only to be used from the GUI thread.
+class MemoryBudget final : public QObject
+{
+	Q_OBJECT
+
+public:
+	static MemoryBudget &instance() noexcept;
+
+	MemoryBudget(const MemoryBudget &) = delete;
+	MemoryBudget &operator=(const MemoryBudget &) = delete;
+	MemoryBudget(MemoryBudget &&) = delete;
+	MemoryBudget &operator=(MemoryBudget &&) = delete;
+
+	int64_t limit() const noexcept;
+	void setLimit(int64_t bytes) noexcept;
+
+	int64_t used() const noexcept;
+	int64_t used(MemoryCategory category) const noexcept;
+
+	void registerClient(MemoryClient *client) noexcept;
+	void unregisterClient(MemoryClient *client) noexcept;
+	void setActive(MemoryClient *client) noexcept;
+
+	void charge(MemoryClient *client, MemoryCategory category, int64_t bytes) noexcept;
+	void release(MemoryClient *client, MemoryCategory category, int64_t bytes) noexcept;
+
+signals:
+	void usageChanged(int64_t used, int64_t limit);
+
+private:
+	MemoryBudget() noexcept;
+
+	void enforce() noexcept;
+
+	struct ClientUsage
+	{
+		MemoryClient *client;
+		std::array<int64_t, 3> bytes;
+	};
+
+	ClientUsage *find(MemoryClient *client) noexcept;
+
+private:
+	// ordered from least to most recently active
+	QVector<ClientUsage> clients;
+	MemoryClient *active = nullptr;
+
+	std::array<int64_t, 3> totals{};
+	int64_t limitBytes;
+	bool enforcing = false;
+};
@@ -0,0 +1,369 @@
+#include "NativeDecoder.hpp"
+
+#include <QImage>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "log.hpp"
+
+#if defined(HAVE_TURBOJPEG)
+#	include <turbojpeg.h>
+#endif
+
+#if defined(HAVE_LIBWEBP)
+#	include <webp/decode.h>
+#endif
+
+#if defined(HAVE_LIBPNG)
+#	include <csetjmp>
+#	include <png.h>
+#endif
+
+// QImage's 32 bpp formats are native endian words, so their byte order depends on the platform
+constexpr auto little_endian = Q_BYTE_ORDER == Q_LITTLE_ENDIAN;
+
+#if defined(HAVE_TURBOJPEG)
+static bool isJpeg(const QByteArray &content) noexcept
+{
+	return content.startsWith("\xFF\xD8\xFF");
+}
+
+static std::optional<DecodedImage> decodeJpeg(const QByteArray &content, QSize size, Qt::AspectRatioMode mode) noexcept
+{
+	auto handle = std::unique_ptr<void, decltype(&tjDestroy)>(tjInitDecompress(), &tjDestroy);
+	if (!handle)
+		return {};
+
+	auto data = reinterpret_cast<const unsigned char *>(content.constData());
+	auto length = static_cast<unsigned long>(content.size());
+
+	int width, height, subsampling, colorspace;
+	if (tjDecompressHeader3(handle.get(), data, length, &width, &height, &subsampling, &colorspace) != 0)
+	{
+		LOG_DEBUG("Could not read jpeg header: {0}", tjGetErrorStr2(handle.get()));
+		return {};
+	}
+
+	// turbojpeg can't convert these to RGB, Qt's plugin can
+	if (colorspace == TJCS_CMYK || colorspace == TJCS_YCCK)
+		return {};
+
+	DecodedImage result;
+	result.originalSize = QSize(width, height);
+	auto target = decodeSize(result.originalSize, size, mode);
+
+	// use the smallest DCT scaling that still covers the target, smooth scaling does the rest
+	auto scaled = result.originalSize;
+	int factorCount = 0;
+	auto factors = tjGetScalingFactors(&factorCount);
+	for (int i = 0; i < factorCount; ++i)
+	{
+		auto candidate = QSize(TJSCALED(width, factors[i]), TJSCALED(height, factors[i]));
+		if (candidate.width() >= target.width() && candidate.height() >= target.height() && candidate.width() < scaled.width())
+			scaled = candidate;
+	}
+
+	QImage image(scaled, QImage::Format_RGB32);
+	if (image.isNull())
+		return {};
+
+	// the alpha formats write 0xff, where the X ones leave the byte undefined and RGB32 needs it set
+	constexpr auto pixel_format = little_endian ? TJPF_BGRA : TJPF_ARGB;
+	if (tjDecompress2(handle.get(), data, length, image.bits(), scaled.width(), image.bytesPerLine(), scaled.height(), pixel_format, TJFLAG_FASTDCT) != 0)
+	{
+		// a truncated or slightly broken file still decodes to something worth showing
+		LOG_DEBUG("Decoding jpeg: {0}", tjGetErrorStr2(handle.get()));
+		if (tjGetErrorCode(handle.get()) != TJERR_WARNING)
+			return {};
+	}
+
+	result.image = finishImage(std::move(image), target);
+	return result;
+}
+#endif
+
+#if defined(HAVE_LIBWEBP)
+static bool isWebp(const QByteArray &content) noexcept
+{
+	return content.size() >= 12 && content.startsWith("RIFF") && std::memcmp(content.constData() + 8, "WEBP", 4) == 0;
+}
+
+static std::optional<DecodedImage> decodeWebp(const QByteArray &content, QSize size, Qt::AspectRatioMode mode) noexcept
+{
+	auto data = reinterpret_cast<const uint8_t *>(content.constData());
+	auto length = static_cast<size_t>(content.size());
+
+	WebPDecoderConfig config;
+	if (!WebPInitDecoderConfig(&config) || WebPGetFeatures(data, length, &config.input) != VP8_STATUS_OK)
+		return {};
+
+	// animations are played through Qt's reader
+	if (config.input.has_animation)
+		return {};
+
+	DecodedImage result;
+	result.originalSize = QSize(config.input.width, config.input.height);
+	auto target = decodeSize(result.originalSize, size, mode);
+
+	// libwebp scales while decoding, so the image is written once at its final size
+	config.options.use_threads = 1;
+	if (target != result.originalSize)
+	{
+		config.options.use_scaling = 1;
+		config.options.scaled_width = target.width();
+		config.options.scaled_height = target.height();
+	}
+
+	auto hasAlpha = config.input.has_alpha != 0;
+	QImage image(target, displayFormat(hasAlpha));
+	if (image.isNull())
+		return {};
+
+	if (hasAlpha)
+		config.output.colorspace = little_endian ? MODE_bgrA : MODE_Argb;
+	else
+		config.output.colorspace = little_endian ? MODE_BGRA : MODE_ARGB;
+
+	config.output.is_external_memory = 1;
+	config.output.u.RGBA.rgba = image.bits();
+	config.output.u.RGBA.stride = image.bytesPerLine();
+	config.output.u.RGBA.size = static_cast<size_t>(image.sizeInBytes());
+
+	auto status = WebPDecode(data, length, &config);
+	WebPFreeDecBuffer(&config.output);
+
+	if (status != VP8_STATUS_OK)
+	{
+		LOG_DEBUG("Could not decode webp image: status {0}", static_cast<int>(status));
+		return {};
+	}
+
+	result.image = finishImage(std::move(image), target);
+	return result;
+}
+#endif
+
+#if defined(HAVE_LIBPNG)
+static bool isPng(const QByteArray &content) noexcept
+{
+	return content.startsWith("\x89PNG\r\n\x1A\n");
+}
+
+// APNG keeps its animation control chunk ahead of the image data. The simplified API only
+// reads the default image, so these are left to a plugin that can play them.
+static bool isAnimatedPng(const QByteArray &content) noexcept
+{
+	// chunks are a big endian length, a type, the data and a crc
+	constexpr qint64 signature_size = 8;
+	constexpr qint64 chunk_overhead = 12;
+
+	auto bytes = reinterpret_cast<const unsigned char *>(content.constData());
+	for (auto offset = signature_size; offset + 8 <= content.size();)
+	{
+		auto chunk = bytes + offset;
+		auto length = qint64{chunk[0]} << 24 | qint64{chunk[1]} << 16 | qint64{chunk[2]} << 8 | qint64{chunk[3]};
+
+		if (std::memcmp(chunk + 4, "acTL", 4) == 0)
+			return true;
+		if (std::memcmp(chunk + 4, "IDAT", 4) == 0)
+			return false;
+
+		offset += length + chunk_overhead;
+	}
+
+	return false;
+}
+
+static std::optional<DecodedImage> decodePng(const QByteArray &content, QSize size, Qt::AspectRatioMode mode) noexcept
+{
+	if (isAnimatedPng(content))
+		return {};
+
+	png_image png{};
+	png.version = PNG_IMAGE_VERSION;
+
+	if (!png_image_begin_read_from_memory(&png, content.constData(), static_cast<size_t>(content.size())))
+	{
+		LOG_DEBUG("Could not read png header: {0}", png.message);
+		return {};
+	}
+
+	// the simplified API fills in an opaque alpha channel for images without one
+	auto hasAlpha = (png.format & PNG_FORMAT_FLAG_ALPHA) != 0;
+	png.format = little_endian ? PNG_FORMAT_BGRA : PNG_FORMAT_ARGB;
+
+	DecodedImage result;
+	result.originalSize = QSize(static_cast<int>(png.width), static_cast<int>(png.height));
+
+	QImage image(result.originalSize, hasAlpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+	if (image.isNull())
+	{
+		png_image_free(&png);
+		return {};
+	}
+
+	if (!png_image_finish_read(&png, nullptr, image.bits(), image.bytesPerLine(), nullptr))
+	{
+		LOG_DEBUG("Could not decode png image: {0}", png.message);
+		png_image_free(&png);
+		return {};
+	}
+
+	result.image = finishImage(std::move(image), decodeSize(result.originalSize, size, mode));
+	return result;
+}
+
+// Where the pixels of each Adam7 pass sit, as the spacing of the grid known once it's complete
+constexpr int adam7_step_x[] = {8, 4, 4, 2, 2, 1, 1};
+constexpr int adam7_step_y[] = {8, 8, 4, 4, 2, 2, 1};
+
+struct PngProgress
+{
+	QImage image;
+	int pass = 0;
+	bool interlaced = false;
+	bool complete = false;
+};
+
+static void ignorePngWarning(png_structp, png_const_charp)
+{
+}
+
+static void pngInfoReady(png_structp png, png_infop info)
+{
+	auto progress = static_cast<PngProgress *>(png_get_progressive_ptr(png));
+
+	auto colorType = png_get_color_type(png, info);
+	auto hasAlpha = (colorType & PNG_COLOR_MASK_ALPHA) != 0 || png_get_valid(png, info, PNG_INFO_tRNS) != 0;
+
+	png_set_expand(png);
+	png_set_strip_16(png);
+	png_set_gray_to_rgb(png);
+
+	// write straight into a 32 bpp QImage, which is BGRA in memory on little endian machines
+	if constexpr (little_endian)
+	{
+		png_set_bgr(png);
+		if (!hasAlpha)
+			png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+	}
+	else
+	{
+		png_set_swap_alpha(png);
+		if (!hasAlpha)
+			png_set_filler(png, 0xff, PNG_FILLER_BEFORE);
+	}
+
+	progress->interlaced = png_set_interlace_handling(png) > 1;
+	png_read_update_info(png, info);
+
+	progress->image = QImage(static_cast<int>(png_get_image_width(png, info)), static_cast<int>(png_get_image_height(png, info)),
+		hasAlpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+	progress->image.fill(Qt::gray);
+}
+
+static void pngRowReady(png_structp png, png_bytep row, png_uint_32 rowNumber, int pass)
+{
+	auto progress = static_cast<PngProgress *>(png_get_progressive_ptr(png));
+	progress->pass = pass;
+
+	if (row && !progress->image.isNull())
+		png_progressive_combine_row(png, progress->image.scanLine(static_cast<int>(rowNumber)), row);
+}
+
+static void pngEnd(png_structp png, png_infop)
+{
+	static_cast<PngProgress *>(png_get_progressive_ptr(png))->complete = true;
+}
+
+// libpng reports errors by jumping back to the setjmp, so this is kept free of anything that
+// would need destroying on the way out
+static bool processPng(png_structp png, png_infop info, PngProgress *progress, const QByteArray &partial) noexcept
+{
+	if (setjmp(png_jmpbuf(png)))
+		return false;
+
+	// push mode takes the bytes as they are and simply waits for more at the end
+	png_set_progressive_read_fn(png, progress, pngInfoReady, pngRowReady, pngEnd);
+	png_process_data(png, info, reinterpret_cast<png_bytep>(const_cast<char *>(partial.constData())), static_cast<size_t>(partial.size()));
+	return true;
+}
+
+// The pixels of the completed interlace passes, which cover the whole image at a lower resolution
+static QImage pngPassPreview(const QImage &image, int completedPasses)
+{
+	auto stepX = adam7_step_x[completedPasses - 1];
+	auto stepY = adam7_step_y[completedPasses - 1];
+
+	QImage preview((image.width() + stepX - 1) / stepX, (image.height() + stepY - 1) / stepY, image.format());
+	for (int y = 0; y < preview.height(); ++y)
+	{
+		auto source = reinterpret_cast<const QRgb *>(image.constScanLine(y * stepY));
+		auto target = reinterpret_cast<QRgb *>(preview.scanLine(y));
+		for (int x = 0; x < preview.width(); ++x)
+			target[x] = source[x * stepX];
+	}
+
+	return preview;
+}
+
+static std::optional<DecodedImage> decodePartialPng(const QByteArray &partial, QSize size, Qt::AspectRatioMode mode) noexcept
+{
+	if (isAnimatedPng(partial))
+		return {};
+
+	auto png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, ignorePngWarning);
+	if (!png)
+		return {};
+
+	auto info = png_create_info_struct(png);
+
+	PngProgress progress;
+	auto processed = info && processPng(png, info, &progress, partial);
+	png_destroy_read_struct(&png, &info, nullptr);
+
+	if (!processed || progress.image.isNull())
+		return {};
+
+	DecodedImage result;
+	result.originalSize = progress.image.size();
+
+	auto image = std::move(progress.image);
+	if (progress.interlaced && !progress.complete)
+	{
+		// rows of the pass being read are scattered, the passes before it make a complete picture
+		if (progress.pass == 0)
+			return {};
+
+		image = pngPassPreview(image, progress.pass);
+	}
+
+	result.image = finishImage(std::move(image), decodeSize(result.originalSize, size, mode));
+	return result;
+}
+#endif
+
+static const std::vector<NativeDecoder> native_decoders = {
+#if defined(HAVE_TURBOJPEG)
+	{.name = "libjpeg-turbo", .matches = isJpeg, .decode = decodeJpeg, .decodePartial = nullptr},
+#endif
+#if defined(HAVE_LIBWEBP)
+	{.name = "libwebp", .matches = isWebp, .decode = decodeWebp, .decodePartial = nullptr},
+#endif
+#if defined(HAVE_LIBPNG)
+	{.name = "libpng", .matches = isPng, .decode = decodePng, .decodePartial = decodePartialPng},
+#endif
+};
+
+const NativeDecoder *findNativeDecoder(const QByteArray &content) noexcept
+{
+	auto it = std::find_if(native_decoders.begin(), native_decoders.end(), [&](const NativeDecoder &decoder) { return decoder.matches(content); });
+	if (it != native_decoders.end())
+		return &*it;
+
+	return nullptr;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <QByteArray>
+#include <QSize>
+
+#include <optional>
+
+#include "Decoder.hpp"
+
+// Decodes one format straight through its codec library instead of Qt's image plugins, which
+// lets it use the library's fastest settings and write directly into a display format image.
+// An empty result leaves the image to the plugins.
+struct NativeDecoder
+{
+	const char *name;
+	bool (*matches)(const QByteArray &content) noexcept;
+	std::optional<DecodedImage> (*decode)(const QByteArray &content, QSize size, Qt::AspectRatioMode mode) noexcept;
+
+	// Decode the start of an image, for formats that need to be fed incrementally to make sense
+	// of a prefix. Optional, decode is used when not set.
+	std::optional<DecodedImage> (*decodePartial)(const QByteArray &partial, QSize size, Qt::AspectRatioMode mode) noexcept;
+};
+
+// The decoder for the format of the given content, if this build has one
+const NativeDecoder *findNativeDecoder(const QByteArray &content) noexcept;
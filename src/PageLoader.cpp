@@ -0,0 +1,357 @@
+#include "PageLoader.hpp"
+
+#include <QThreadPool>
+
+#include <algorithm>
+#include <utility>
+
+#include "SpillStore.hpp"
+#include "log.hpp"
+
+// recently decoded pages, for flipping back or returning to an earlier zoom without decoding again
+constexpr auto cache_limit_kib = 64 * 1024;
+
+// below decoding, which the view is waiting on
+constexpr auto spill_priority = -1;
+
+static int costKiB(const DecodedImage &result) noexcept
+{
+	return static_cast<int>(result.image.sizeInBytes() / 1024) + 1;
+}
+
+PageLoader::PageLoader(QObject *parent) noexcept : QObject(parent)
+{
+	cache.setMaxCost(cache_limit_kib);
+}
+
+PageLoader::~PageLoader()
+{
+	for (auto &request : requests)
+		abandon(request);
+
+	for (auto &preview : previews)
+		preview.stop.request_stop();
+}
+
+void PageLoader::setPageCount(int count) noexcept
+{
+	contents.resize(count);
+}
+
+int64_t PageLoader::setContent(int index, QByteArray content) noexcept
+{
+	if (index < 0 || index >= contents.size())
+		return 0;
+
+	if (!store)
+		store = std::make_shared<SpillStore>();
+
+	auto &slot = contents[index];
+	slot.size = content.size();
+	slot.spilled = nullptr;
+	slot.bytes = std::move(content);
+	slot.generation = ++nextGeneration;
+
+	// the bytes are usable straight away, they move off the heap once the write is done
+	if (store->isOpen() && !slot.bytes.isEmpty())
+	{
+		auto worker = new SpillWorker(store, slot.bytes);
+		connect(
+			worker, &SpillWorker::spilled, this,
+			[this, index, generation = slot.generation](QByteArray mapped) { finishSpill(index, generation, std::move(mapped)); }, Qt::QueuedConnection);
+
+		QThreadPool::globalInstance()->start(worker, spill_priority);
+	}
+
+	stopPreview(index);
+
+	// requests that were waiting on the bytes can go ahead now
+	for (auto it = requests.begin(); it != requests.end(); ++it)
+	{
+		if (it.key().index == index && !it->started)
+			start(it.key(), it.value());
+	}
+
+	return slot.bytes.size();
+}
+
+void PageLoader::finishSpill(int index, uint64_t generation, QByteArray mapped) noexcept
+{
+	// replaced in the meantime, or the write failed and the bytes stay where they are
+	if (index >= contents.size() || contents[index].generation != generation || mapped.isNull())
+		return;
+
+	// also taken when the bytes were dropped while they were being written, so they don't have to
+	// be read from the archive again
+	auto &slot = contents[index];
+	auto released = slot.bytes.size();
+	slot.spilled = mapped.constData();
+	slot.bytes = QByteArray();
+
+	if (released > 0)
+		emit contentSpilled(released);
+}
+
+QByteArray PageLoader::content(int index) const noexcept
+{
+	if (!hasContent(index))
+		return {};
+
+	// a copy, as the caller may hold on to it for longer than the spill file exists
+	auto &slot = contents[index];
+	return slot.spilled ? QByteArray(slot.spilled, slot.size) : slot.bytes;
+}
+
+QByteArray PageLoader::mappedContent(int index) const noexcept
+{
+	auto &slot = contents[index];
+	return slot.spilled ? QByteArray::fromRawData(slot.spilled, slot.size) : slot.bytes;
+}
+
+bool PageLoader::hasContent(int index) const noexcept
+{
+	return index >= 0 && index < contents.size() && (contents[index].spilled || !contents[index].bytes.isNull());
+}
+
+void PageLoader::setPartialContent(int index, QByteArray partial) noexcept
+{
+	if (hasContent(index))
+		return;
+
+	auto preview = previews.find(index);
+	if (preview != previews.end() && preview->running)
+	{
+		preview->next = std::move(partial);
+		return;
+	}
+
+	startPreview(index, std::move(partial));
+}
+
+int64_t PageLoader::dropContent(int index) noexcept
+{
+	if (index < 0 || index >= contents.size())
+		return 0;
+
+	auto &slot = contents[index];
+	auto bytes = slot.bytes.size();
+	slot.bytes = QByteArray();
+	return bytes;
+}
+
+QFuture<DecodedImage> PageLoader::requestPage(int index, QSize size, Qt::AspectRatioMode mode, int priority, bool useCache) noexcept
+{
+	if (index < 0 || index >= contents.size())
+	{
+		QFutureInterface<DecodedImage> promise(QFutureInterfaceBase::Canceled);
+		promise.reportFinished();
+		return promise.future();
+	}
+
+	auto key = Key{.index = index, .size = size, .mode = mode};
+
+	auto held = shown.find(key);
+	if (held != shown.end())
+	{
+		QFutureInterface<DecodedImage> promise(QFutureInterfaceBase::Started);
+		promise.reportFinished(&held.value());
+		return promise.future();
+	}
+
+	if (cache.contains(key))
+	{
+		QFutureInterface<DecodedImage> promise(QFutureInterfaceBase::Started);
+		auto cached = takeCached(key);
+		promise.reportFinished(&cached);
+
+		// on screen again, where the caller accounts for it
+		if (useCache)
+			shown.insert(key, std::move(cached));
+		else
+			cacheResult(key, cached);
+
+		return promise.future();
+	}
+
+	auto existing = requests.find(key);
+	if (existing != requests.end())
+	{
+		existing->priority = std::max(existing->priority, priority);
+		existing->useCache = existing->useCache || useCache;
+		return existing->promise.future();
+	}
+
+	// a page asked for at a new size no longer needs the old one, e.g. after a resize or zoom
+	cancel(index, mode);
+
+	auto &request = requests[key];
+	request.promise.reportStarted();
+	request.serial = nextSerial++;
+	request.priority = priority;
+	request.useCache = useCache;
+
+	auto future = request.promise.future();
+
+	if (hasContent(index))
+		start(key, request);
+	else
+		emit contentNeeded(index);
+
+	return future;
+}
+
+void PageLoader::cancel(int index, Qt::AspectRatioMode mode) noexcept
+{
+	for (auto it = requests.begin(); it != requests.end();)
+	{
+		if (it.key().index == index && it.key().mode == mode)
+		{
+			abandon(it.value());
+			it = requests.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+	// what was shown of the page is let go of, keep it around in case the page comes back
+	for (auto it = shown.begin(); it != shown.end();)
+	{
+		if (it.key().index == index && it.key().mode == mode)
+		{
+			cacheResult(it.key(), it.value());
+			it = shown.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+void PageLoader::clearCache() noexcept
+{
+	auto bytes = qint64{cache.totalCost()} * 1024;
+	cache.clear();
+	shown.clear();
+
+	if (bytes > 0)
+		emit cacheMemoryChanged(-bytes);
+}
+
+void PageLoader::start(const Key &key, Request &request) noexcept
+{
+	request.started = true;
+
+	// nobody is waiting for the result anymore
+	if (request.promise.isCanceled())
+		return;
+
+	auto worker = new DecodeWorker(mappedContent(key.index), key.size, key.mode, request.stop.get_token());
+	worker->setOwner(store);
+	connect(
+		worker, &DecodeWorker::decoded, this,
+		[this, key, serial = request.serial](DecodedImage result) { finish(key, serial, std::move(result)); }, Qt::QueuedConnection);
+
+	QThreadPool::globalInstance()->start(worker, request.priority);
+}
+
+void PageLoader::finish(const Key &key, uint64_t serial, DecodedImage result) noexcept
+{
+	auto it = requests.find(key);
+	if (it == requests.end() || it->serial != serial)
+		return;
+
+	auto promise = it->promise;
+	auto useCache = it->useCache;
+	requests.erase(it);
+
+	if (result.image.isNull())
+		LOG_DEBUG("Could not decode page #{0}", key.index);
+	else if (useCache)
+		shown.insert(key, result);
+
+	promise.reportFinished(&result);
+}
+
+void PageLoader::abandon(Request &request) noexcept
+{
+	request.stop.request_stop();
+	request.promise.cancel();
+	request.promise.reportFinished();
+}
+
+void PageLoader::startPreview(int index, QByteArray partial) noexcept
+{
+	// only pages that are waiting to be shown are worth a preview
+	auto keys = requests.keys();
+	auto waiting = std::find_if(keys.begin(), keys.end(), [index](const Key &key) { return key.index == index && key.mode == Qt::IgnoreAspectRatio; });
+	if (waiting == keys.end())
+	{
+		previews.remove(index);
+		return;
+	}
+
+	auto &preview = previews[index];
+	preview.running = true;
+	preview.next = QByteArray();
+
+	auto worker = new DecodeWorker(std::move(partial), waiting->size, waiting->mode, preview.stop.get_token());
+	worker->setPartial(true);
+	connect(
+		worker, &DecodeWorker::decoded, this, [this, index](DecodedImage result) { finishPreview(index, std::move(result)); }, Qt::QueuedConnection);
+
+	QThreadPool::globalInstance()->start(worker, requests[*waiting].priority);
+}
+
+void PageLoader::finishPreview(int index, DecodedImage result) noexcept
+{
+	// the whole page arrived in the meantime
+	if (!previews.contains(index))
+		return;
+
+	previews[index].running = false;
+
+	if (!result.image.isNull())
+		emit previewReady(index, result);
+
+	auto preview = previews.find(index);
+	if (preview == previews.end())
+		return;
+
+	auto next = std::exchange(preview->next, QByteArray());
+	if (next.isNull())
+		previews.erase(preview);
+	else
+		startPreview(index, std::move(next));
+}
+
+void PageLoader::stopPreview(int index) noexcept
+{
+	auto preview = previews.find(index);
+	if (preview == previews.end())
+		return;
+
+	preview->stop.request_stop();
+	previews.erase(preview);
+}
+
+DecodedImage PageLoader::takeCached(const Key &key) noexcept
+{
+	auto before = cache.totalCost();
+	std::unique_ptr<DecodedImage> cached(cache.take(key));
+
+	auto delta = qint64{cache.totalCost() - before} * 1024;
+	if (delta != 0)
+		emit cacheMemoryChanged(delta);
+
+	return cached ? std::move(*cached) : DecodedImage();
+}
+
+void PageLoader::cacheResult(const Key &key, const DecodedImage &result) noexcept
+{
+	auto before = cache.totalCost();
+	cache.insert(key, new DecodedImage(result), costKiB(result));
+
+	auto delta = qint64{cache.totalCost() - before} * 1024;
+	if (delta != 0)
+		emit cacheMemoryChanged(delta);
+}
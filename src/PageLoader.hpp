@@ -0,0 +1,166 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCache>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QObject>
+#include <QPair>
+#include <QSize>
+#include <QVector>
+
+#include <cstdint>
+#include <memory>
+#include <version>
+
+#if defined(__cpp_lib_jthread)
+#	include <stop_token>
+using std::stop_source;
+#else
+#	include "stop_source.hpp"
+#endif
+
+#include "Decoder.hpp"
+
+class SpillStore;
+
+// Hands out the pages of one archive decoded at a requested size. Identical requests in flight
+// share a single decode, a request for a new size supersedes the previous one for that page, and
+// recent results are served from a small cache. Requests for pages whose encoded bytes aren't
+// there wait for setContent, contentNeeded asks for them.
+//
+// Encoded bytes are spilled to a scratch file and mapped back in, so they don't stay on the heap
+// for the life of the archive. The write happens on the thread pool, contentSpilled reports the
+// heap bytes given up once it is done. They are only kept in memory when spilling fails.
+//
+// Only to be used from the GUI thread, decoding happens on the global thread pool.
+class PageLoader final : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit PageLoader(QObject *parent = nullptr) noexcept;
+	~PageLoader() override;
+
+	PageLoader(const PageLoader &) = delete;
+	PageLoader &operator=(const PageLoader &) = delete;
+	PageLoader(PageLoader &&) = delete;
+	PageLoader &operator=(PageLoader &&) = delete;
+
+	void setPageCount(int count) noexcept;
+
+	// Returns how many of the bytes are held in memory until they are spilled
+	int64_t setContent(int index, QByteArray content) noexcept;
+	QByteArray content(int index) const noexcept;
+	bool hasContent(int index) const noexcept;
+
+	// The start of a page that is still being read. Pages the view is waiting on get a preview
+	// decoded from it, only the latest bytes are used when they come in faster than that.
+	void setPartialContent(int index, QByteArray partial) noexcept;
+
+	// Forget the encoded bytes of a page held in memory, returns how many bytes that freed. Spilled
+	// bytes cost no memory and are kept.
+	int64_t dropContent(int index) noexcept;
+
+	// Decode a page, see decodeImage for how size and mode are applied. Higher priorities are
+	// decoded first. Results the caller keeps itself, like thumbnails, can skip the cache.
+	//
+	// Cached results are held without being charged for as long as the page is shown, the caller
+	// accounts for the image then. They are charged to the cache once the page is cancelled.
+	QFuture<DecodedImage> requestPage(int index, QSize size, Qt::AspectRatioMode mode = Qt::IgnoreAspectRatio, int priority = 0, bool useCache = true) noexcept;
+
+	// Give up on any requests for a page that are still in flight
+	void cancel(int index, Qt::AspectRatioMode mode) noexcept;
+
+	void clearCache() noexcept;
+
+signals:
+	void contentNeeded(int index);
+	void cacheMemoryChanged(qint64 delta);
+	void contentSpilled(qint64 bytes);
+	void previewReady(int index, const DecodedImage &preview);
+
+private:
+	struct Key
+	{
+		int index;
+		QSize size;
+		Qt::AspectRatioMode mode;
+
+		bool operator==(const Key &other) const noexcept = default;
+
+		friend uint qHash(const Key &key, uint seed = 0) noexcept
+		{
+			return qHash(qMakePair(key.index, key.size.width()), seed) ^ qHash(qMakePair(key.size.height(), static_cast<int>(key.mode)), seed);
+		}
+	};
+
+	struct Request
+	{
+		QFutureInterface<DecodedImage> promise;
+		stop_source stop;
+		uint64_t serial = 0;
+		int priority = 0;
+		bool useCache = true;
+		bool started = false;
+	};
+
+	struct Content
+	{
+		QByteArray bytes;
+		const char *spilled = nullptr;
+		int size = 0;
+		uint64_t generation = 0;
+	};
+
+	// the content without copying it out of the spill file, only valid while the store is alive
+	QByteArray mappedContent(int index) const noexcept;
+
+	void finishSpill(int index, uint64_t generation, QByteArray mapped) noexcept;
+
+	void start(const Key &key, Request &request) noexcept;
+	void finish(const Key &key, uint64_t serial, DecodedImage result) noexcept;
+	void abandon(Request &request) noexcept;
+	void cacheResult(const Key &key, const DecodedImage &result) noexcept;
+	DecodedImage takeCached(const Key &key) noexcept;
+
+	struct Preview
+	{
+		QByteArray next;
+		stop_source stop;
+		bool running = false;
+	};
+
+	void startPreview(int index, QByteArray partial) noexcept;
+	void finishPreview(int index, DecodedImage result) noexcept;
+	void stopPreview(int index) noexcept;
+
+private:
+	QVector<Content> contents;
+	std::shared_ptr<SpillStore> store;
+	QHash<Key, Request> requests;
+	QHash<int, Preview> previews;
+	QCache<Key, DecodedImage> cache;
+
+	// results that were handed out to be shown, they share their pixels with what is on screen
+	QHash<Key, DecodedImage> shown;
+	uint64_t nextSerial = 0;
+	uint64_t nextGeneration = 0;
+};
+
+// Call done with the result once the future has finished, unless it was cancelled or the context
+// object is gone by then
+template <typename T, typename Function>
+void whenReady(const QFuture<T> &future, QObject *context, Function done)
+{
+	auto watcher = new QFutureWatcher<T>(context);
+	QObject::connect(watcher, &QFutureWatcherBase::finished, context, [watcher, callback = std::move(done)] {
+		if (!watcher->isCanceled() && watcher->future().resultCount() > 0)
+			callback(watcher->result());
+
+		watcher->deleteLater();
+	});
+	watcher->setFuture(future);
+}
@@ -0,0 +1,204 @@
+#include "RepackCache.hpp"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+
+#include "log.hpp"
+
+constexpr char magic[] = "JIROREPK";
+constexpr int magic_size = sizeof(magic) - 1;
+constexpr quint32 format_version = 1;
+
+// repacked archives are uncompressed, so keep a lid on how much disk they take
+constexpr qint64 max_cache_bytes = qint64{8} * 1024 * 1024 * 1024;
+
+static QString cacheDir()
+{
+	return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("repack");
+}
+
+static QString cachePath(const QString &sourcePath)
+{
+	auto key = QCryptographicHash::hash(QFileInfo(sourcePath).absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex();
+	return QDir(cacheDir()).filePath(QString::fromLatin1(key) + ".jrc");
+}
+
+static void initStream(QDataStream &stream)
+{
+	stream.setVersion(QDataStream::Qt_5_12);
+	stream.setByteOrder(QDataStream::LittleEndian);
+}
+
+// remove the least recently used caches until the rest fit
+static void pruneCache()
+{
+	auto files = QDir(cacheDir()).entryInfoList({"*.jrc"}, QDir::Files, QDir::Time | QDir::Reversed);
+
+	qint64 total = 0;
+	for (auto &&info : files)
+		total += info.size();
+
+	for (auto &&info : files)
+	{
+		if (total <= max_cache_bytes)
+			break;
+
+		LOG_DEBUG("Pruning repack cache '{0}'", info.fileName().toStdString());
+		total -= info.size();
+		QFile::remove(info.absoluteFilePath());
+	}
+}
+
+RepackCache::RepackCache() noexcept = default;
+RepackCache::~RepackCache() = default;
+RepackCache::RepackCache(RepackCache &&) noexcept = default;
+RepackCache &RepackCache::operator=(RepackCache &&) noexcept = default;
+
+std::optional<RepackCache> RepackCache::open(const QString &sourcePath) noexcept
+{
+	auto path = cachePath(sourcePath);
+	if (!QFileInfo::exists(path))
+		return std::nullopt;
+
+	RepackCache cache;
+	cache.file = std::make_unique<QFile>(path);
+	if (!cache.file->open(QIODevice::ReadWrite))
+		return std::nullopt;
+
+	QDataStream stream(cache.file.get());
+	initStream(stream);
+
+	char header[magic_size];
+	quint32 version = 0;
+	qint64 sourceSize = 0;
+	qint64 sourceModified = 0;
+
+	if (stream.readRawData(header, magic_size) != magic_size || !std::equal(header, header + magic_size, magic))
+		return std::nullopt;
+
+	stream >> version >> sourceSize >> sourceModified;
+
+	auto source = QFileInfo(sourcePath);
+	if (stream.status() != QDataStream::Ok || version != format_version || sourceSize != source.size() ||
+		sourceModified != source.lastModified().toMSecsSinceEpoch())
+	{
+		LOG_INFO("Repack cache for '{0}' is out of date", sourcePath.toStdString());
+		cache.file->remove();
+		return std::nullopt;
+	}
+
+	// the index sits at the end, followed by its offset
+	qint64 indexOffset = 0;
+	cache.file->seek(cache.file->size() - qint64{sizeof(qint64)});
+	stream >> indexOffset;
+	cache.file->seek(indexOffset);
+
+	quint32 count = 0;
+	stream >> count;
+
+	for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i)
+	{
+		Entry entry;
+		qint64 offset = 0;
+		qint64 size = 0;
+
+		stream >> entry.index >> entry.filename >> offset >> size;
+		cache.entryList.push_back(entry);
+		cache.locations.insert(entry.index, {offset, size});
+	}
+
+	if (stream.status() != QDataStream::Ok)
+	{
+		LOG_WARN("Repack cache for '{0}' is damaged", sourcePath.toStdString());
+		cache.file->remove();
+		return std::nullopt;
+	}
+
+	// mark as recently used so pruning takes the others first
+	cache.file->setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+
+	return cache;
+}
+
+const QVector<Entry> &RepackCache::entries() const noexcept
+{
+	return entryList;
+}
+
+QByteArray RepackCache::read(uint32_t index) noexcept
+{
+	auto it = locations.find(index);
+	if (it == locations.end() || !file->seek(it->first))
+		return {};
+
+	return file->read(it->second);
+}
+
+RepackWriter::RepackWriter(const QString &sourcePath) noexcept : file(std::make_unique<QSaveFile>(cachePath(sourcePath)))
+{
+	QDir().mkpath(cacheDir());
+
+	if (!file->open(QIODevice::WriteOnly))
+	{
+		LOG_WARN("Could not create repack cache for '{0}': {1}", sourcePath.toStdString(), file->errorString().toStdString());
+		failed = true;
+		return;
+	}
+
+	auto source = QFileInfo(sourcePath);
+
+	QDataStream stream(file.get());
+	initStream(stream);
+	stream.writeRawData(magic, magic_size);
+	stream << format_version << qint64{source.size()} << qint64{source.lastModified().toMSecsSinceEpoch()};
+}
+
+RepackWriter::~RepackWriter() = default;
+
+void RepackWriter::add(const Entry &entry, const QByteArray &content) noexcept
+{
+	if (failed)
+		return;
+
+	auto offset = file->pos();
+	if (file->write(content) != content.size())
+	{
+		failed = true;
+		return;
+	}
+
+	locations.push_back({.entry = entry, .offset = offset, .size = content.size()});
+}
+
+bool RepackWriter::commit() noexcept
+{
+	if (failed)
+	{
+		file->cancelWriting();
+		return false;
+	}
+
+	auto indexOffset = file->pos();
+
+	QDataStream stream(file.get());
+	initStream(stream);
+	stream << quint32(locations.size());
+	for (auto &&location : locations)
+		stream << location.entry.index << location.entry.filename << location.offset << location.size;
+	stream << indexOffset;
+
+	if (stream.status() != QDataStream::Ok || !file->commit())
+		return false;
+
+	LOG_INFO("Repacked {0} entries to '{1}'", locations.size(), file->fileName().toStdString());
+	pruneCache();
+	return true;
+}
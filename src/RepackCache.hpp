@@ -0,0 +1,73 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include "Archive.hpp"
+
+class QFile;
+class QSaveFile;
+
+// Solid archives have to be decompressed from the start to reach any entry. After one full read,
+// their entries are kept uncompressed in a local cache file with an index, so any single entry
+// can be read on its own. The cache is only used while the source file keeps its size and
+// modification time.
+class RepackCache final
+{
+public:
+	static std::optional<RepackCache> open(const QString &sourcePath) noexcept;
+
+	~RepackCache();
+	RepackCache(RepackCache &&) noexcept;
+	RepackCache &operator=(RepackCache &&) noexcept;
+
+	RepackCache(const RepackCache &) = delete;
+	RepackCache &operator=(const RepackCache &) = delete;
+
+	const QVector<Entry> &entries() const noexcept;
+	QByteArray read(uint32_t index) noexcept;
+
+private:
+	RepackCache() noexcept;
+
+private:
+	std::unique_ptr<QFile> file;
+	QVector<Entry> entryList;
+	QHash<uint32_t, QPair<qint64, qint64>> locations;
+};
+
+// Writes a repack cache as entries are extracted. Nothing is visible to RepackCache::open until
+// commit succeeds.
+class RepackWriter final
+{
+public:
+	explicit RepackWriter(const QString &sourcePath) noexcept;
+	~RepackWriter();
+
+	RepackWriter(const RepackWriter &) = delete;
+	RepackWriter &operator=(const RepackWriter &) = delete;
+	RepackWriter(RepackWriter &&) = delete;
+	RepackWriter &operator=(RepackWriter &&) = delete;
+
+	void add(const Entry &entry, const QByteArray &content) noexcept;
+	bool commit() noexcept;
+
+private:
+	struct Location
+	{
+		Entry entry;
+		qint64 offset;
+		qint64 size;
+	};
+
+	std::unique_ptr<QSaveFile> file;
+	QVector<Location> locations;
+	bool failed = false;
+};
@@ -0,0 +1,118 @@
+#include "SpillStore.hpp"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QStandardPaths>
+#include <QStorageInfo>
+#include <QTemporaryFile>
+
+#include <mutex>
+
+#include "log.hpp"
+
+// spill files not written to for this long are from an instance that is gone
+constexpr auto stale_after_secs = 24 * 60 * 60;
+
+static QString spillDir()
+{
+	return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("spill");
+}
+
+// tmpfs and the like keep their files in memory, so spilling to them frees nothing
+static bool isMemoryBacked(const QString &path)
+{
+	auto type = QStorageInfo(path).fileSystemType();
+	return type == "tmpfs" || type == "ramfs";
+}
+
+// files left behind by a crash. Another instance may still be using a file, so only ones it
+// hasn't written to in a while are removed, which wouldn't stop it reading what is mapped anyway.
+static void removeStaleFiles(const QString &dir)
+{
+	auto cutoff = QDateTime::currentDateTime().addSecs(-stale_after_secs);
+	for (auto &&info : QDir(dir).entryInfoList({"jiro-*.spill"}, QDir::Files))
+	{
+		if (info.lastModified() >= cutoff)
+			continue;
+
+		LOG_DEBUG("Removing stale spill file '{0}'", info.fileName().toStdString());
+		QFile::remove(info.absoluteFilePath());
+	}
+}
+
+SpillStore::SpillStore() noexcept : file(std::make_unique<QTemporaryFile>(QDir(spillDir()).filePath("jiro-XXXXXX.spill")))
+{
+	// the last worker using the store can drop it on a pool thread. A file without a thread can
+	// be closed and removed on any of them, it never receives events.
+	file->moveToThread(nullptr);
+
+	auto dir = spillDir();
+	if (!QDir().mkpath(dir))
+	{
+		LOG_WARN("Could not create spill directory '{0}', pages stay in memory", dir.toStdString());
+		return;
+	}
+
+	static std::once_flag swept;
+	std::call_once(swept, removeStaleFiles, dir);
+
+	if (isMemoryBacked(dir))
+	{
+		LOG_INFO("Spill directory '{0}' is memory backed, pages stay in memory", dir.toStdString());
+		return;
+	}
+
+	if (file->open())
+		LOG_DEBUG("Spilling pages to '{0}'", file->fileName().toStdString());
+	else
+		LOG_WARN("Could not create spill file, pages stay in memory: {0}", file->errorString().toStdString());
+}
+
+SpillStore::~SpillStore()
+{
+	// unmaps everything handed out, rather than leaving it to auto removal
+	if (file->isOpen() && !file->remove())
+		LOG_WARN("Could not remove spill file '{0}': {1}", file->fileName().toStdString(), file->errorString().toStdString());
+}
+
+bool SpillStore::isOpen() const noexcept
+{
+	return file->isOpen();
+}
+
+const char *SpillStore::append(const QByteArray &content) noexcept
+{
+	if (!isOpen() || content.isEmpty())
+		return nullptr;
+
+	QMutexLocker lock(&mutex);
+
+	// a failed write leaves end where it was, so whatever made it to the file is overwritten next time
+	if (!file->seek(end) || file->write(content) != content.size() || !file->flush())
+	{
+		LOG_WARN("Could not write to spill file: {0}", file->errorString().toStdString());
+		return nullptr;
+	}
+
+	auto mapped = file->map(end, content.size());
+	if (!mapped)
+	{
+		LOG_WARN("Could not map spill file: {0}", file->errorString().toStdString());
+		return nullptr;
+	}
+
+	end += content.size();
+	return reinterpret_cast<const char *>(mapped);
+}
+
+SpillWorker::SpillWorker(std::shared_ptr<SpillStore> store, QByteArray content) noexcept : store(std::move(store)), content(std::move(content))
+{
+}
+
+void SpillWorker::run()
+{
+	auto mapped = store->append(content);
+	emit spilled(mapped ? QByteArray::fromRawData(mapped, content.size()) : QByteArray());
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QByteArray>
+#include <QMutex>
+#include <QObject>
+#include <QRunnable>
+
+#include <memory>
+
+class QTemporaryFile;
+
+// An append only scratch file for the encoded bytes of pages. Bytes written to it are mapped back
+// in, so the OS reads them in when they are used and can drop them again under memory pressure,
+// rather than them taking up heap for as long as the archive is open. The file is removed, and
+// everything handed out unmapped, when the store is destroyed.
+//
+// The file lives in the cache directory. It is not opened when that is on a memory backed file
+// system, as spilled bytes would take up just as much memory there, only without being counted.
+class SpillStore final
+{
+public:
+	SpillStore() noexcept;
+	~SpillStore();
+
+	SpillStore(const SpillStore &) = delete;
+	SpillStore &operator=(const SpillStore &) = delete;
+	SpillStore(SpillStore &&) = delete;
+	SpillStore &operator=(SpillStore &&) = delete;
+
+	bool isOpen() const noexcept;
+
+	// Write the bytes to the end of the file and return where they are mapped, or nullptr when
+	// they couldn't be written or mapped. Safe to call from any thread.
+	const char *append(const QByteArray &content) noexcept;
+
+private:
+	std::unique_ptr<QTemporaryFile> file;
+	QMutex mutex;
+	qint64 end = 0;
+};
+
+// Spills one page off the GUI thread, as writing it out can block on the disk
+class SpillWorker final : public QObject, public QRunnable
+{
+	Q_OBJECT
+
+public:
+	SpillWorker(std::shared_ptr<SpillStore> store, QByteArray content) noexcept;
+
+private:
+	void run() override;
+
+signals:
+	// The mapped bytes, or a null array when they couldn't be spilled. Only valid while the store
+	// is alive.
+	void spilled(QByteArray mapped);
+
+private:
+	std::shared_ptr<SpillStore> store;
+	QByteArray content;
+};
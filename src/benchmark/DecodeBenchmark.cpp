@@ -0,0 +1,112 @@
+// Compares decode throughput of the native decoders against Qt's image plugins, per format.
+//
+//     decode_benchmark [--iterations N] <image files or folders>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "../Decoder.hpp"
+#include "../NativeDecoder.hpp"
+
+// a page decoded to fit a typical screen, next to decoding at full size
+constexpr auto screen_size = QSize(1920, 1920);
+
+struct Sample
+{
+	QByteArray content;
+	qint64 pixels;
+};
+
+using DecodeFunction = std::function<DecodedImage(const QByteArray &, QSize, Qt::AspectRatioMode)>;
+
+static void addFile(QMap<QString, QVector<Sample>> &samples, const QString &path)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly))
+		return;
+
+	auto content = file.readAll();
+	auto image = decodeWithPlugins(content, {});
+	if (image.image.isNull())
+		return;
+
+	auto pixels = qint64{image.originalSize.width()} * image.originalSize.height();
+	samples[QFileInfo(path).suffix().toLower()].append({.content = std::move(content), .pixels = pixels});
+}
+
+static void run(const QString &format, const QVector<Sample> &samples, const char *path, const DecodeFunction &decode, QSize size, int iterations)
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	auto pixels = qint64{0};
+	for (int i = 0; i < iterations; ++i)
+	{
+		for (const auto &sample : samples)
+		{
+			auto result = decode(sample.content, size, Qt::KeepAspectRatio);
+			if (!result.image.isNull())
+				pixels += sample.pixels;
+		}
+	}
+
+	auto seconds = static_cast<double>(timer.nsecsElapsed()) / 1e9;
+	auto images = samples.size() * iterations;
+	fmt::print("{:<6} {:<14} {:>9} {:>10.2f} {:>12.1f}\n", format.toStdString(), path, size.isValid() ? "screen" : "full", seconds * 1000 / images,
+		static_cast<double>(pixels) / 1e6 / seconds);
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Measures per-format decode throughput of the native decoders and Qt's image plugins");
+	parser.addHelpOption();
+	parser.addOption({"iterations", "How often every image is decoded.", "count", "5"});
+	parser.addPositionalArgument("paths", "Image files or folders to decode.", "<paths...>");
+	parser.process(app);
+
+	auto iterations = std::max(1, parser.value("iterations").toInt());
+
+	QMap<QString, QVector<Sample>> samples;
+	for (const auto &path : parser.positionalArguments())
+	{
+		if (QFileInfo(path).isDir())
+		{
+			QDirIterator it(path, QDir::Files, QDirIterator::Subdirectories);
+			while (it.hasNext())
+				addFile(samples, it.next());
+		}
+		else
+			addFile(samples, path);
+	}
+
+	if (samples.isEmpty())
+		parser.showHelp(1);
+
+	fmt::print("{:<6} {:<14} {:>9} {:>10} {:>12}\n", "format", "decoder", "size", "ms/image", "source MP/s");
+
+	for (auto it = samples.cbegin(); it != samples.cend(); ++it)
+	{
+		for (auto size : {QSize(), screen_size})
+		{
+			run(it.key(), it.value(), "Qt plugins", decodeWithPlugins, size, iterations);
+
+			if (auto decoder = findNativeDecoder(it.value().first().content))
+				run(it.key(), it.value(), decoder->name, decodeImage, size, iterations);
+		}
+	}
+
+	return 0;
+}
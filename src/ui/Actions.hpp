@@ -8,9 +8,19 @@ namespace ui
 	{
 		QAction *quit;
 		QAction *open;
+		QAction *openNext;
 		QAction *close;
+		QAction *library;
 		QAction *fitH;
 		QAction *fitV;
+		QAction *zoomIn;
+		QAction *zoomOut;
+		QAction *zoomReset;
+		QAction *singlePage;
+		QAction *spread;
+		QAction *continuous;
 		QAction *fullscreen;
+		QAction *memoryLimit;
+		QAction *repackSolid;
 	};
 }
@@ -1,24 +1,47 @@
 #include "ImageView.hpp"
 
+#include <QElapsedTimer>
 #include <QHBoxLayout>
 #include <QImage>
-#include <QImageReader>
-#include <QLabel>
 #include <QListWidget>
 #include <QListWidgetItem>
 #include <QPixmap>
-#include <QScrollArea>
-#include <QScrollBar>
 #include <QSizePolicy>
 #include <QThreadPool>
+#include <QTimer>
 
 #include <algorithm>
+#include <cstdlib>
+#include <utility>
 
+#include "../Animation.hpp"
 #include "../Archive.hpp"
+#include "../Decoder.hpp"
+#include "../PageLoader.hpp"
 #include "../log.hpp"
+#include "PageStrip.hpp"
 
 constexpr auto IndexRole = Qt::UserRole + 1;
-constexpr auto ImageRole = Qt::UserRole + 2;
+constexpr auto ThumbnailRole = Qt::UserRole + 4;
+constexpr auto ExtractedRole = Qt::UserRole + 5;
+constexpr auto AnimatedRole = Qt::UserRole + 6;
+
+constexpr auto thumbnail_size = 256;
+
+// pages being read are decoded ahead of thumbnails
+constexpr auto page_priority = 1;
+constexpr auto thumbnail_priority = 0;
+
+// how close to the last page the reader gets before the next archive is worth preparing
+constexpr auto nearing_end_pages = 5;
+
+// pages on either side of the current one whose encoded bytes are kept when trimming the active view
+constexpr auto working_set_radius = 1;
+
+static int64_t pixmapBytes(const QPixmap &pixmap)
+{
+	return int64_t{pixmap.width()} * pixmap.height() * pixmap.depth() / 8;
+}
 
 static QListWidgetItem *findEntry(QListWidget *list, const Entry &entry)
 {
@@ -46,103 +69,243 @@ static QListWidgetItem *findEntry(QListWidget *list, const Entry &entry)
 namespace ui
 {
 	ImageView::ImageView(const QString &archive, const Actions &actions, QWidget *parent) noexcept
-		: fileName(archive), QWidget(parent), imageList(new QListWidget), mainImage(new QLabel), scrollArea(new QScrollArea), actions(actions)
+		: fileName(archive), QWidget(parent), imageList(new QListWidget), pageStrip(new PageStrip), loader(new PageLoader(this)), actions(actions), waiting(std::make_shared<WaitingEntries>())
 	{
 		auto mainLayout = new QHBoxLayout;
 
 		imageList->setSortingEnabled(true);
 		imageList->setSizePolicy(QSizePolicy(QSizePolicy::Minimum, QSizePolicy::Minimum));
-		scrollArea->setAlignment(Qt::AlignHCenter | Qt::AlignVCenter);
-		scrollArea->setWidget(mainImage);
 		mainLayout->addWidget(imageList);
-		mainLayout->addWidget(scrollArea);
+		mainLayout->addWidget(pageStrip);
 
 		setLayout(mainLayout);
 
-		auto archiveWorker = new ReadArchiveWorker(archive, cancellationSource.get_token());
+		auto updateFit = [this] { pageStrip->setFit(this->actions.fitH->isChecked(), this->actions.fitV->isChecked()); };
+
+		updateFit();
+		connect(actions.fitH, &QAction::toggled, this, updateFit);
+		connect(actions.fitV, &QAction::toggled, this, updateFit);
+
+		// zoom is kept per archive, so only the tab in front follows the shortcuts
+		connect(actions.zoomIn, &QAction::triggered, this, [this] {
+			if (isVisible())
+				pageStrip->zoomIn();
+		});
+		connect(actions.zoomOut, &QAction::triggered, this, [this] {
+			if (isVisible())
+				pageStrip->zoomOut();
+		});
+		connect(actions.zoomReset, &QAction::triggered, this, [this] {
+			if (isVisible())
+				pageStrip->setZoom(1.0);
+		});
+
+		auto updateMode = [this] {
+			if (this->actions.continuous->isChecked())
+				pageStrip->setMode(ReadingMode::Continuous);
+			else if (this->actions.spread->isChecked())
+				pageStrip->setMode(ReadingMode::Spread);
+			else
+				pageStrip->setMode(ReadingMode::Single);
+		};
+
+		updateMode();
+		connect(actions.singlePage, &QAction::toggled, this, updateMode);
+		connect(actions.spread, &QAction::toggled, this, updateMode);
+		connect(actions.continuous, &QAction::toggled, this, updateMode);
 
-		auto resizeImage = [this] { showImage(imageList->currentItem(), nullptr); };
+		connect(imageList, &QListWidget::currentItemChanged, this, &ImageView::showImage);
+		connect(pageStrip, &PageStrip::currentPageChanged, this, [this](int index) { imageList->setCurrentRow(index); });
+		connect(pageStrip, &PageStrip::pageNeeded, this, &ImageView::loadPage);
+		connect(pageStrip, &PageStrip::pageReleased, this, [this](int index) {
+			releaseAnimation(index);
+			loader->cancel(index, Qt::IgnoreAspectRatio);
+			if (auto item = imageList->item(index))
+				waiting->remove(item->data(IndexRole).value<uint32_t>());
+		});
+		connect(pageStrip, &PageStrip::visiblePagesChanged, this, [this] {
+			for (auto it = animations.begin(); it != animations.end(); ++it)
+				it.value()->setPlaying(pageStrip->isPageVisible(it.key()));
+		});
+		auto chargeDecoded = [this](qint64 delta) {
+			auto &budget = MemoryBudget::instance();
+			if (delta > 0)
+				budget.charge(this, MemoryCategory::Decoded, delta);
+			else
+				budget.release(this, MemoryCategory::Decoded, -delta);
+		};
+
+		connect(pageStrip, &PageStrip::imageMemoryChanged, this, chargeDecoded);
+		connect(loader, &PageLoader::cacheMemoryChanged, this, chargeDecoded);
+		connect(loader, &PageLoader::contentSpilled, this, [this](qint64 bytes) { MemoryBudget::instance().release(this, MemoryCategory::Encoded, bytes); });
+
+		// large pages are shown as they are read, and sharpen once they are complete
+		connect(loader, &PageLoader::previewReady, this, [this](int index, const DecodedImage &preview) {
+			pageStrip->setPageSize(index, preview.originalSize);
+			pageStrip->setPageImage(index, preview.image);
+		});
+
+		// pages that haven't been extracted yet are still on their way from the archive worker, and
+		// are shown while they are read
+		connect(loader, &PageLoader::contentNeeded, this, [this](int index) {
+			auto item = imageList->item(index);
+			if (!item)
+				return;
+
+			auto entry = item->data(IndexRole).value<uint32_t>();
+			waiting->add(entry);
+			if (item->data(ExtractedRole).toBool())
+				reloadEntry(entry);
+		});
+
+		MemoryBudget::instance().registerClient(this);
+		startArchiveWorker();
+	}
 
-		connect(actions.fitH, &QAction::toggled, this, resizeImage);
-		connect(actions.fitV, &QAction::toggled, this, resizeImage);
+	void ImageView::startArchiveWorker(const QVector<uint32_t> &wanted) noexcept
+	{
+		auto archiveWorker = new ReadArchiveWorker(fileName, cancellationSource.get_token());
+		archiveWorker->setWanted(wanted);
+		archiveWorker->setRepack(actions.repackSolid->isChecked());
+		archiveWorker->setProgressive(waiting);
 
 		connect(
 			archiveWorker, &ReadArchiveWorker::error, this, [](QString msg) { LOG_ERROR("Archive error: {0}", msg.toStdString()); }, Qt::QueuedConnection);
 
+		connect(archiveWorker, &ReadArchiveWorker::contents, this, &ImageView::addEntries, Qt::QueuedConnection);
+		connect(archiveWorker, &ReadArchiveWorker::entryReady, this, &ImageView::addEntryData, Qt::QueuedConnection);
 		connect(
-			archiveWorker, &ReadArchiveWorker::contents, this,
-			[this](QVector<Entry> entries) {
-				LOG_DEBUG("Entry names ready");
-
-				totalFiles = entries.size();
-				emit workStarted(totalFiles);
-
-				for (auto &&entry : entries)
-				{
-					auto item = new QListWidgetItem(entry.filename);
-					item->setData(IndexRole, entry.index);
-					imageList->addItem(item);
-				}
+			archiveWorker, &ReadArchiveWorker::entryProgress, this,
+			[this](Entry entry, QByteArray partial) {
+				if (auto item = findEntry(imageList, entry))
+					loader->setPartialContent(imageList->row(item), std::move(partial));
 			},
 			Qt::QueuedConnection);
+		connect(archiveWorker, &ReadArchiveWorker::destroyed, this, [this, wanted] {
+			for (auto index : wanted)
+				reloading.remove(index);
+		});
 
-		connect(
-			archiveWorker, &ReadArchiveWorker::entryReady, this,
-			[this](Entry entry, EntryData entryData) {
-				LOG_DEBUG("Entry ready: #{0}: '{1}' ({2})", entry.index, entry.filename.toStdString(), entryData.type.name().toStdString());
+		QThreadPool::globalInstance()->start(archiveWorker);
+	}
 
-				++totalExtracted;
-				emit workUpdated(totalExtracted, totalFiles);
+	void ImageView::addPrefetched(const PrefetchedArchive &archive) noexcept
+	{
+		LOG_DEBUG("Using {0} prefetched pages of '{1}'", archive.pages.size(), archive.path.toStdString());
 
-				auto item = findEntry(imageList, entry);
-				if (!item)
+		addEntries(archive.entries);
+		for (auto &&[entry, entryData] : archive.pages)
+			addEntryData(entry, entryData);
+	}
+
+	void ImageView::addEntries(const QVector<Entry> &entries) noexcept
+	{
+		LOG_DEBUG("Entry names ready");
+
+		// when reloading pages that were trimmed, or the entries were prefetched, the list is already populated
+		if (imageList->count() > 0)
+			return;
+
+		totalFiles = entries.size();
+		emit workStarted(totalFiles);
+
+		for (auto &&entry : entries)
+		{
+			auto item = new QListWidgetItem(entry.filename);
+			item->setData(IndexRole, entry.index);
+			imageList->addItem(item);
+		}
+
+		loader->setPageCount(imageList->count());
+		pageStrip->setPageCount(imageList->count());
+		imageList->setCurrentRow(0);
+	}
+
+	void ImageView::addEntryData(const Entry &entry, const EntryData &entryData) noexcept
+	{
+		LOG_DEBUG("Entry ready: #{0}: '{1}' ({2})", entry.index, entry.filename.toStdString(), entryData.type.name().toStdString());
+
+		auto item = findEntry(imageList, entry);
+		if (!item)
+		{
+			LOG_ERROR("Couldn't find existing entry");
+			return;
+		}
+
+		auto &budget = MemoryBudget::instance();
+		auto row = imageList->row(item);
+		waiting->remove(entry.index);
+
+		// bytes count against the budget until they are spilled to disk
+		if (!loader->hasContent(row))
+		{
+			auto kept = loader->setContent(row, entryData.content);
+			if (kept > 0)
+				budget.charge(this, MemoryCategory::Encoded, kept);
+		}
+
+		// seen before, either reloading after a trim or the page was prefetched. Only the encoded
+		// bytes needed restoring, the thumbnail and progress are already there
+		if (item->data(ExtractedRole).toBool())
+		{
+			pageStrip->reloadPage(row);
+			return;
+		}
+
+		item->setData(ExtractedRole, true);
+		++totalExtracted;
+		emit workUpdated(totalExtracted, totalFiles);
+
+		// the next archive isn't fetched while this one is still extracting, so a reader who got near
+		// the end before it finished is only caught now
+		auto current = imageList->currentRow();
+		if (totalExtracted == totalFiles && current >= 0 && current >= imageList->count() - nearing_end_pages)
+			emit nearingEnd();
+
+		// most formats can decode a thumbnail directly at a reduced size, and the original
+		// size comes along with it to lay out the page. It skips the loader's cache, the icon holds
+		// on to it and is charged as a thumbnail.
+		auto request = loader->requestPage(row, {thumbnail_size, thumbnail_size}, Qt::KeepAspectRatio, thumbnail_priority, false);
+		whenReady(request, this, [this, item, row, type = entryData.type](const DecodedImage &result) {
+			if (!result.image.isNull())
+			{
+				auto thumbnail = QPixmap::fromImage(result.image);
+				MemoryBudget::instance().charge(this, MemoryCategory::Thumbnail, pixmapBytes(thumbnail));
+				item->setIcon(QIcon(thumbnail));
+				item->setData(ThumbnailRole, true);
+				item->setData(AnimatedRole, result.animated);
+
+				pageStrip->setPageSize(row, result.originalSize);
+				pageStrip->reloadPage(row);
+			}
+			else
+			{
+				// fallback - try to load an icon based on the mime type
+				LOG_WARN("Could not create pixmap");
+				item->setData(ThumbnailRole, false);
+				if (QIcon::hasThemeIcon(type.iconName()))
 				{
-					LOG_ERROR("Couldn't find existing entry");
-					return;
+					auto icon = QIcon::fromTheme(type.iconName());
+					item->setIcon(icon);
 				}
-
-				QPixmap pixmap;
-				if (pixmap.loadFromData(entryData.content))
+				else if (QIcon::hasThemeIcon(type.genericIconName()))
 				{
-					// success. Create an icon and keep the pixmap around
-					// as userdata in our list so we can display it later
-					item->setIcon(QIcon(pixmap));
-					item->setData(ImageRole, pixmap);
-
-					if (imageList->currentItem() == item)
-						showImage(item, nullptr);
+					auto icon = QIcon::fromTheme(type.genericIconName());
+					item->setIcon(icon);
 				}
 				else
 				{
-					// fallback - try to load an icon based on the mime type
-					LOG_WARN("Could not create pixmap");
-					if (QIcon::hasThemeIcon(entryData.type.iconName()))
-					{
-						auto icon = QIcon::fromTheme(entryData.type.iconName());
-						item->setIcon(icon);
-					}
-					else if (QIcon::hasThemeIcon(entryData.type.genericIconName()))
-					{
-						auto icon = QIcon::fromTheme(entryData.type.genericIconName());
-						item->setIcon(icon);
-					}
-					else
-					{
-						// TODO: use icon for unknown
-					}
+					// TODO: use icon for unknown
 				}
-			},
-			Qt::QueuedConnection);
-
-		connect(imageList, &QListWidget::currentItemChanged, this, &ImageView::showImage);
-
-		QThreadPool::globalInstance()->start(archiveWorker);
+			}
+		});
 	}
 
 	ImageView::~ImageView()
 	{
 		LOG_DEBUG("~ImageView() cancelling work");
 		cancellationSource.request_stop();
+		MemoryBudget::instance().unregisterClient(this);
 	}
 
 	QString ImageView::archiveName() const noexcept
@@ -165,34 +328,123 @@ namespace ui
 		if (!current)
 		{
 			LOG_DEBUG("show image called with null current item");
-			mainImage->setPixmap({});
 			return;
 		}
 
 		emit activeItemUpdated(current->text());
 
-		auto pixmap = current->data(ImageRole).value<QPixmap>();
+		// pages that became current by scrolling the strip are already where they should be, moving
+		// them to the top would make the view jump while scrolling
+		auto row = imageList->row(current);
+		if (pageStrip->currentPage() != row)
+			pageStrip->setCurrentPage(row);
+
+		if (row >= imageList->count() - nearing_end_pages)
+			emit nearingEnd();
+	}
+
+	void ImageView::loadPage(int index, QSize size) noexcept
+	{
+		auto item = imageList->item(index);
+		if (!item)
+			return;
+
+		if (item->data(AnimatedRole).toBool())
+		{
+			// the entry is shown again once its bytes have been read back from the archive
+			if (loader->hasContent(index))
+				playAnimation(index, size);
+			else if (item->data(ExtractedRole).toBool())
+				reloadEntry(item->data(IndexRole).value<uint32_t>());
+			return;
+		}
+
+		whenReady(loader->requestPage(index, size, Qt::IgnoreAspectRatio, page_priority), this, [this, index](const DecodedImage &result) {
+			if (result.image.isNull())
+				LOG_WARN("Could not decode page #{0}", index);
+
+			// the image is already in the display format, so this only hands it over to be painted
+			QElapsedTimer timer;
+			timer.start();
+			pageStrip->setPageImage(index, result.image);
+			LOG_TRACE("Page #{0} handed to the view in {1} ns", index, timer.nsecsElapsed());
+		});
+	}
+
+	void ImageView::reloadEntry(uint32_t index) noexcept
+	{
+		if (reloading.contains(index))
+			return;
+
+		// pages asked for together are read together, so a solid archive is only streamed once
+		if (pendingReload.isEmpty())
+		{
+			QTimer::singleShot(0, this, [this] {
+				LOG_DEBUG("Reloading {0} trimmed pages from '{1}'", pendingReload.size(), fileName.toStdString());
+				startArchiveWorker(std::exchange(pendingReload, {}));
+			});
+		}
 
-		auto viewportSize = scrollArea->maximumViewportSize();
-		auto scrollSize = QSize(scrollArea->verticalScrollBar()->size().width(), scrollArea->horizontalScrollBar()->size().height());
+		reloading.insert(index);
+		pendingReload.push_back(index);
+	}
 
-		auto availableSize = viewportSize - scrollSize;
+	void ImageView::playAnimation(int index, QSize size) noexcept
+	{
+		auto player = animations.value(index);
+		if (!player || player->size() != size)
+		{
+			releaseAnimation(index);
 
-		if (actions.fitH->isChecked() && actions.fitV->isChecked())
-			pixmap = pixmap.scaled(availableSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-		else if (actions.fitH->isChecked())
-			pixmap = pixmap.scaledToWidth(availableSize.width(), Qt::SmoothTransformation);
-		else if (actions.fitV->isChecked())
-			pixmap = pixmap.scaledToHeight(availableSize.height(), Qt::SmoothTransformation);
+			// a copy of the bytes, only taken when there is a new player to hand them to
+			player = new AnimationPlayer(loader->content(index), size, this);
+			connect(player, &AnimationPlayer::frameReady, this, [this, index](QImage frame) { pageStrip->setPageImage(index, std::move(frame)); });
+			animations.insert(index, player);
+			MemoryBudget::instance().charge(this, MemoryCategory::Decoded, player->bufferBytes());
+		}
 
-		mainImage->setPixmap(pixmap);
-		mainImage->resize(pixmap.size());
+		player->setPlaying(pageStrip->isPageVisible(index));
 	}
 
-	void ImageView::resizeEvent(QResizeEvent *event)
+	void ImageView::releaseAnimation(int index) noexcept
 	{
-		QWidget::resizeEvent(event);
-		showImage(imageList->currentItem(), nullptr);
+		auto player = animations.take(index);
+		if (!player)
+			return;
+
+		// this can be reached from the player's own frameReady, so it has to outlive the signal
+		MemoryBudget::instance().release(this, MemoryCategory::Decoded, player->bufferBytes());
+		player->setPlaying(false);
+		player->deleteLater();
 	}
 
+	void ImageView::trimMemory(MemoryCategory category, bool keepWorkingSet) noexcept
+	{
+		if (category == MemoryCategory::Thumbnail)
+			return;
+
+		if (category == MemoryCategory::Decoded)
+		{
+			// released pages go to the loader's cache, so that is cleared after them
+			pageStrip->releaseImages(keepWorkingSet);
+			loader->clearCache();
+			return;
+		}
+
+		auto current = imageList->currentRow();
+		int64_t released = 0;
+
+		for (int i = 0; i < imageList->count(); ++i)
+		{
+			// pages of the working set that are already on screen don't need their bytes until they are
+			// decoded again, and can be read back from the archive by then
+			if (keepWorkingSet && std::abs(i - current) <= working_set_radius && !pageStrip->hasPageImage(i))
+				continue;
+
+			released += loader->dropContent(i);
+		}
+
+		LOG_DEBUG("Trimmed {0} bytes from '{1}'", released, fileName.toStdString());
+		MemoryBudget::instance().release(this, category, released);
+	}
 }
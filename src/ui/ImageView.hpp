@@ -1,8 +1,13 @@
 #pragma once
 
+#include <QHash>
+#include <QSet>
 #include <QString>
+#include <QVector>
 #include <QWidget>
 
+#include <cstdint>
+#include <memory>
 #include <version>
 
 #if defined(__cpp_lib_jthread)
@@ -13,17 +18,23 @@ using std::stop_token;
 #	include "../stop_source.hpp"
 #endif
 
+#include "../MemoryBudget.hpp"
 #include "Actions.hpp"
 
-class QLabel;
+class AnimationPlayer;
+class PageLoader;
 class QListWidget;
 class QListWidgetItem;
-class QScrollArea;
+class WaitingEntries;
 struct Entry;
+struct EntryData;
+struct PrefetchedArchive;
 
 namespace ui
 {
-	class ImageView final : public QWidget
+	class PageStrip;
+
+	class ImageView final : public QWidget, public MemoryClient
 	{
 		Q_OBJECT
 
@@ -53,25 +64,41 @@ namespace ui
 
 		QString activeItem() const noexcept;
 
+		// Fill in entries and pages read ahead of time, to be called right after construction
+		void addPrefetched(const PrefetchedArchive &archive) noexcept;
+
+		void trimMemory(MemoryCategory category, bool keepWorkingSet) noexcept override;
+
 	signals:
 		void workStarted(int total);
 		void workUpdated(int completed, int total);
 		void activeItemUpdated(const QString &name);
+		void nearingEnd();
 
 	private:
+		void startArchiveWorker(const QVector<uint32_t> &wanted = {}) noexcept;
+		void reloadEntry(uint32_t index) noexcept;
+		void addEntries(const QVector<Entry> &entries) noexcept;
+		void addEntryData(const Entry &entry, const EntryData &entryData) noexcept;
 		void showImage(QListWidgetItem *current, QListWidgetItem *previous) noexcept;
-		void resizeEvent(QResizeEvent *event) override;
+		void loadPage(int index, QSize size) noexcept;
+		void playAnimation(int index, QSize size) noexcept;
+		void releaseAnimation(int index) noexcept;
 
 	private:
 		QString fileName;
 		QListWidget *imageList;
-		QLabel *mainImage;
-		QScrollArea *scrollArea;
+		PageStrip *pageStrip;
+		PageLoader *loader;
+		QHash<int, AnimationPlayer *> animations;
 
 		Actions actions;
 
 		int totalExtracted = 0;
 		int totalFiles = 0;
+		QSet<uint32_t> reloading;
+		QVector<uint32_t> pendingReload;
+		std::shared_ptr<WaitingEntries> waiting;
 
 		stop_source cancellationSource;
 	};
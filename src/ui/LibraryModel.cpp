@@ -0,0 +1,149 @@
+#include "LibraryModel.hpp"
+
+#include <QFileInfo>
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+constexpr auto max_cached_covers = 512;
+
+// batches adding more rows than this reset the model instead
+constexpr auto max_inserted_rows = 32;
+
+static bool byPath(const CatalogRecord &record, const QString &path)
+{
+	return record.path < path;
+}
+
+static bool pathOrder(const CatalogRecord &a, const CatalogRecord &b)
+{
+	return a.path < b.path;
+}
+
+namespace ui
+{
+	LibraryModel::LibraryModel(Catalog *catalog, QObject *parent) noexcept : QAbstractListModel(parent), catalog(catalog), covers(max_cached_covers)
+	{
+		connect(catalog, &Catalog::recordsUpdated, this, &LibraryModel::update);
+		connect(catalog, &Catalog::recordRemoved, this, &LibraryModel::remove);
+	}
+
+	int LibraryModel::rowCount(const QModelIndex &parent) const
+	{
+		return parent.isValid() ? 0 : records.size();
+	}
+
+	QVariant LibraryModel::data(const QModelIndex &index, int role) const
+	{
+		if (!index.isValid() || index.row() >= records.size())
+			return {};
+
+		auto &record = records[index.row()];
+
+		switch (role)
+		{
+		case Qt::DisplayRole:
+			return QFileInfo(record.path).completeBaseName();
+
+		case Qt::ToolTipRole:
+			return tr("%1\n%n page(s)", nullptr, record.pages).arg(record.path);
+
+		case Qt::DecorationRole: {
+			if (auto cover = covers.object(record.path))
+				return *cover;
+
+			auto cover = new QPixmap;
+			if (!cover->loadFromData(catalog->cover(record.path)))
+			{
+				delete cover;
+				return {};
+			}
+
+			covers.insert(record.path, cover);
+			return *cover;
+		}
+
+		default:
+			return {};
+		}
+	}
+
+	QString LibraryModel::path(const QModelIndex &index) const noexcept
+	{
+		if (!index.isValid() || index.row() >= records.size())
+			return {};
+
+		return records[index.row()].path;
+	}
+
+	void LibraryModel::reload() noexcept
+	{
+		beginResetModel();
+		records = catalog->records();
+		covers.clear();
+		endResetModel();
+	}
+
+	void LibraryModel::update(const QVector<CatalogRecord> &batch) noexcept
+	{
+		QVector<CatalogRecord> added;
+
+		for (auto &&record : batch)
+		{
+			covers.remove(record.path);
+
+			auto it = std::lower_bound(records.begin(), records.end(), record.path, byPath);
+			if (it == records.end() || it->path != record.path)
+			{
+				added.push_back(record);
+				continue;
+			}
+
+			*it = record;
+			auto row = int(it - records.begin());
+			emit dataChanged(index(row), index(row));
+		}
+
+		if (added.isEmpty())
+			return;
+
+		std::sort(added.begin(), added.end(), pathOrder);
+
+		// a few rows are inserted where they go, a scan adding many at once merges them in one
+		// pass rather than moving the rows after each of them
+		if (added.size() <= max_inserted_rows)
+		{
+			for (auto &&record : std::as_const(added))
+			{
+				auto row = int(std::lower_bound(records.begin(), records.end(), record.path, byPath) - records.begin());
+				beginInsertRows({}, row, row);
+				records.insert(row, record);
+				endInsertRows();
+			}
+			return;
+		}
+
+		QVector<CatalogRecord> merged;
+		merged.reserve(records.size() + added.size());
+		std::merge(records.begin(), records.end(), added.begin(), added.end(), std::back_inserter(merged), pathOrder);
+
+		beginResetModel();
+		records = std::move(merged);
+		endResetModel();
+	}
+
+	void LibraryModel::remove(const QString &path) noexcept
+	{
+		auto it = std::lower_bound(records.begin(), records.end(), path, byPath);
+		if (it == records.end() || it->path != path)
+			return;
+
+		auto row = int(it - records.begin());
+		beginRemoveRows({}, row, row);
+		records.remove(row);
+		endRemoveRows();
+
+		covers.remove(path);
+	}
+}
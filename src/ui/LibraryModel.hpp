@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QPixmap>
+#include <QVector>
+
+#include "../Catalog.hpp"
+
+namespace ui
+{
+	// The catalogued archives ordered by path. Covers are only loaded from the catalog when a row
+	// is drawn, and only a limited number are kept.
+	class LibraryModel final : public QAbstractListModel
+	{
+		Q_OBJECT
+
+	public:
+		explicit LibraryModel(Catalog *catalog, QObject *parent = nullptr) noexcept;
+
+		int rowCount(const QModelIndex &parent = {}) const override;
+		QVariant data(const QModelIndex &index, int role) const override;
+
+		QString path(const QModelIndex &index) const noexcept;
+
+		void reload() noexcept;
+
+	private:
+		void update(const QVector<CatalogRecord> &batch) noexcept;
+		void remove(const QString &path) noexcept;
+
+	private:
+		Catalog *catalog;
+		QVector<CatalogRecord> records;
+		mutable QCache<QString, QPixmap> covers;
+	};
+}
@@ -0,0 +1,71 @@
+#include "LibraryView.hpp"
+
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QListView>
+#include <QPushButton>
+#include <QVBoxLayout>
+
+#include "../Catalog.hpp"
+#include "LibraryModel.hpp"
+
+namespace ui
+{
+	LibraryView::LibraryView(QWidget *parent) noexcept
+		: QWidget(parent), catalog(new Catalog(this)), model(new LibraryModel(catalog, this)), covers(new QListView), status(new QLabel)
+	{
+		auto addButton = new QPushButton(tr("&Add Folder..."));
+		auto rescanButton = new QPushButton(tr("&Rescan"));
+
+		auto toolbar = new QHBoxLayout;
+		toolbar->addWidget(addButton);
+		toolbar->addWidget(rescanButton);
+		toolbar->addWidget(status, 1);
+
+		// uniform sizes and batched layout keep tens of thousands of items responsive
+		covers->setModel(model);
+		covers->setViewMode(QListView::IconMode);
+		covers->setIconSize({160, 240});
+		covers->setGridSize({180, 290});
+		covers->setResizeMode(QListView::Adjust);
+		covers->setMovement(QListView::Static);
+		covers->setUniformItemSizes(true);
+		covers->setLayoutMode(QListView::Batched);
+		covers->setWordWrap(true);
+
+		auto mainLayout = new QVBoxLayout;
+		mainLayout->addLayout(toolbar);
+		mainLayout->addWidget(covers);
+		setLayout(mainLayout);
+
+		connect(addButton, &QPushButton::clicked, this, &LibraryView::addFolder);
+		connect(rescanButton, &QPushButton::clicked, catalog, &Catalog::rescan);
+		connect(covers, &QListView::activated, this, [this](const QModelIndex &index) {
+			auto path = model->path(index);
+			if (!path.isEmpty())
+				emit openRequested(path);
+		});
+
+		connect(catalog, &Catalog::scanProgress, this, [this](int completed, int total) {
+			status->setText(tr("Reading covers: %1 of %2").arg(completed).arg(total));
+		});
+		connect(catalog, &Catalog::scanFinished, this, [this] { status->setText(tr("%n archive(s)", nullptr, model->rowCount())); });
+
+		// show what is already known straight away, then catch up with any changes on disk
+		model->reload();
+		status->setText(tr("%n archive(s)", nullptr, model->rowCount()));
+
+		if (catalog->folders().isEmpty())
+			status->setText(tr("Add a folder to build your library"));
+		else
+			catalog->rescan();
+	}
+
+	void LibraryView::addFolder() noexcept
+	{
+		auto folder = QFileDialog::getExistingDirectory(this, tr("Add Library Folder"));
+		if (!folder.isEmpty())
+			catalog->addFolder(folder);
+	}
+}
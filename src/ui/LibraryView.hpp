@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QString>
+#include <QWidget>
+
+class Catalog;
+class QLabel;
+class QListView;
+
+namespace ui
+{
+	class LibraryModel;
+
+	// Browses every archive in the library folders by cover
+	class LibraryView final : public QWidget
+	{
+		Q_OBJECT
+
+	public:
+		explicit LibraryView(QWidget *parent = nullptr) noexcept;
+
+	signals:
+		void openRequested(const QString &path);
+
+	private:
+		void addFolder() noexcept;
+
+	private:
+		Catalog *catalog;
+		LibraryModel *model;
+		QListView *covers;
+		QLabel *status;
+	};
+}
@@ -1,7 +1,11 @@
 #include "MainWindow.hpp"
 
+#include <QActionGroup>
+#include <QCollator>
+#include <QDir>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QInputDialog>
 #include <QLabel>
 #include <QMenuBar>
 #include <QSettings>
@@ -9,15 +13,43 @@
 #include <QStatusBar>
 #include <QTabWidget>
 
+#include <algorithm>
 #include <tuple>
 #include <utility>
 
+#include "../Archive.hpp"
+#include "../ArchivePrefetch.hpp"
+#include "../MemoryBudget.hpp"
 #include "../log.hpp"
 #include "ImageView.hpp"
+#include "LibraryView.hpp"
 #include "ProgressWidget.hpp"
 
+// bounds of the memory limit, in MiB. Below the minimum a couple of large pages would not fit.
+constexpr auto min_memory_limit_mib = 256;
+constexpr auto max_memory_limit_mib = 1024 * 1024;
+
 namespace ui
 {
+	// The archive after this one in its folder, ordered the way a person would number volumes
+	static QString nextInSeries(const QString &filename)
+	{
+		auto fileInfo = QFileInfo(filename);
+		auto dir = fileInfo.dir();
+		auto siblings = dir.entryList(archiveNameFilters(), QDir::Files);
+
+		QCollator collator;
+		collator.setNumericMode(true);
+		collator.setCaseSensitivity(Qt::CaseInsensitive);
+		std::sort(siblings.begin(), siblings.end(), collator);
+
+		auto it = std::find(siblings.begin(), siblings.end(), fileInfo.fileName());
+		if (it == siblings.end() || ++it == siblings.end())
+			return {};
+
+		return dir.absoluteFilePath(*it);
+	}
+
 	static const auto tab_style =
 		R"(QTabWidget::pane { /* The tab widget frame */
 	border-top: 1px solid #C2C7CB;
@@ -94,6 +126,10 @@ QTabBar::tab:focus:selected {
 		actions.open->setShortcut(QKeySequence::Open);
 		connect(actions.open, &QAction::triggered, this, &MainWindow::fileOpen);
 
+		actions.openNext = fileMenu->addAction(tr("Open &next in series"));
+		actions.openNext->setShortcut({QKeySequence{Qt::CTRL + Qt::SHIFT + Qt::Key_N}});
+		connect(actions.openNext, &QAction::triggered, this, &MainWindow::fileOpenNext);
+
 		actions.close = fileMenu->addAction(tr("&Close"));
 		actions.close->setShortcut(QKeySequence::Close);
 		connect(actions.close, &QAction::triggered, this, &MainWindow::fileClose);
@@ -107,6 +143,12 @@ QTabBar::tab:focus:selected {
 
 		auto viewMenu = mainMenu->addMenu(tr("&View"));
 
+		actions.library = viewMenu->addAction(tr("&Library"));
+		actions.library->setShortcut({QKeySequence{Qt::CTRL + Qt::Key_L}});
+		connect(actions.library, &QAction::triggered, this, &MainWindow::showLibrary);
+
+		viewMenu->addSeparator();
+
 		actions.fitH = viewMenu->addAction(tr("Fit images &horizontally"));
 		actions.fitH->setCheckable(true);
 		actions.fitH->setShortcut({QKeySequence{Qt::CTRL + Qt::Key_1}});
@@ -115,6 +157,34 @@ QTabBar::tab:focus:selected {
 		actions.fitV->setCheckable(true);
 		actions.fitV->setShortcut({QKeySequence{Qt::CTRL + Qt::Key_2}});
 
+		actions.zoomIn = viewMenu->addAction(tr("Zoom &in"));
+		actions.zoomIn->setShortcut(QKeySequence::ZoomIn);
+
+		actions.zoomOut = viewMenu->addAction(tr("Zoom &out"));
+		actions.zoomOut->setShortcut(QKeySequence::ZoomOut);
+
+		actions.zoomReset = viewMenu->addAction(tr("&Reset zoom"));
+		actions.zoomReset->setShortcut({QKeySequence{Qt::CTRL + Qt::Key_0}});
+
+		viewMenu->addSeparator();
+
+		auto readingModes = new QActionGroup(this);
+
+		actions.singlePage = readingModes->addAction(tr("&Single page"));
+		actions.singlePage->setCheckable(true);
+		actions.singlePage->setChecked(true);
+		actions.singlePage->setShortcut({QKeySequence{Qt::CTRL + Qt::Key_3}});
+
+		actions.spread = readingModes->addAction(tr("Two page s&pread"));
+		actions.spread->setCheckable(true);
+		actions.spread->setShortcut({QKeySequence{Qt::CTRL + Qt::Key_4}});
+
+		actions.continuous = readingModes->addAction(tr("&Continuous scroll"));
+		actions.continuous->setCheckable(true);
+		actions.continuous->setShortcut({QKeySequence{Qt::CTRL + Qt::Key_5}});
+
+		viewMenu->addActions(readingModes->actions());
+
 		viewMenu->addSeparator();
 
 		actions.fullscreen = viewMenu->addAction(tr("&Full screen"));
@@ -130,6 +200,23 @@ QTabBar::tab:focus:selected {
 			setWindowState(state);
 		});
 
+		viewMenu->addSeparator();
+
+		actions.memoryLimit = viewMenu->addAction(tr("&Memory limit..."));
+		connect(actions.memoryLimit, &QAction::triggered, this, [this] {
+			auto &budget = MemoryBudget::instance();
+			bool ok = false;
+			auto limitMiB = QInputDialog::getInt(this, tr("Memory Limit"), tr("Memory to use for pages across all tabs (MiB):"),
+				int(budget.limit() / (1024 * 1024)), min_memory_limit_mib, max_memory_limit_mib, 256, &ok);
+
+			if (ok)
+				budget.setLimit(int64_t{limitMiB} * 1024 * 1024);
+		});
+
+		actions.repackSolid = viewMenu->addAction(tr("&Cache solid archives for fast page access"));
+		actions.repackSolid->setCheckable(true);
+		actions.repackSolid->setChecked(true);
+
 		// auto helpMenu = mainMenu->addMenu(tr("&Help"));
 		// auto a = helpMenu->addAction(tr("&About"));
 		// a->setMenuRole(QAction::AboutRole);
@@ -154,6 +241,8 @@ QTabBar::tab:focus:selected {
 			auto widget = tabs->widget(index);
 			auto view = qobject_cast<ImageView *>(widget);
 
+			MemoryBudget::instance().setActive(view);
+
 			if (view)
 			{
 				auto [completed, total] = view->getProgress();
@@ -189,10 +278,21 @@ QTabBar::tab:focus:selected {
 		tabs->setElideMode(Qt::ElideRight);
 		tabs->setTabsClosable(true);
 
+		prefetch = new ArchivePrefetch(this);
+
 		auto status = statusBar();
 		status->addPermanentWidget(progress = new ProgressWidget());
 		progress->hide();
 
+		// how much of the memory limit pages take up across all tabs
+		auto memoryUsage = new QLabel;
+		status->addPermanentWidget(memoryUsage);
+		auto showUsage = [memoryUsage](int64_t used, int64_t limit) {
+			memoryUsage->setText(tr("%1 / %2 MiB").arg(used / (1024 * 1024)).arg(limit / (1024 * 1024)));
+		};
+		connect(&MemoryBudget::instance(), &MemoryBudget::usageChanged, this, showUsage);
+		showUsage(MemoryBudget::instance().used(), MemoryBudget::instance().limit());
+
 		// tabs->setTabShape(QTabWidget::TabShape::Triangular);
 		readSettings();
 	}
@@ -205,20 +305,32 @@ QTabBar::tab:focus:selected {
 		settings.setValue("windowState", saveState());
 		settings.setValue("fitH", actions.fitH->isChecked());
 		settings.setValue("fitV", actions.fitV->isChecked());
+		settings.setValue("spread", actions.spread->isChecked());
+		settings.setValue("continuous", actions.continuous->isChecked());
 		settings.setValue("dir", lastPath);
+		settings.setValue("repackSolid", actions.repackSolid->isChecked());
+		settings.setValue("memoryLimitMiB", qint64{MemoryBudget::instance().limit() / (1024 * 1024)});
 
+		// only archives are restored, other tabs like the library are left out
 		auto numTabs = tabs->count();
-		settings.beginWriteArray("tabs", numTabs);
+		auto savedTabs = 0;
+		auto activeTab = 0;
+		settings.beginWriteArray("tabs");
 		for (int i = 0; i < numTabs; ++i)
 		{
-			settings.setArrayIndex(i);
 			auto view = qobject_cast<ImageView *>(tabs->widget(i));
-			if (view)
-				settings.setValue("name", view->archiveName());
+			if (!view)
+				continue;
+
+			if (i == tabs->currentIndex())
+				activeTab = savedTabs;
+
+			settings.setArrayIndex(savedTabs++);
+			settings.setValue("name", view->archiveName());
 		}
 		settings.endArray();
 
-		settings.setValue("activeTab", tabs->currentIndex());
+		settings.setValue("activeTab", activeTab);
 
 		QMainWindow::closeEvent(event);
 	}
@@ -229,6 +341,21 @@ QTabBar::tab:focus:selected {
 
 		actions.fitH->setChecked(settings.value("fitH", false).toBool());
 		actions.fitV->setChecked(settings.value("fitV", false).toBool());
+		if (settings.value("spread", false).toBool())
+			actions.spread->setChecked(true);
+		else if (settings.value("continuous", false).toBool())
+			actions.continuous->setChecked(true);
+
+		actions.repackSolid->setChecked(settings.value("repackSolid", true).toBool());
+
+		auto &budget = MemoryBudget::instance();
+		// a hand edited or corrupt value falls back to the default rather than starving every tab
+		bool ok = false;
+		auto limitMiB = settings.value("memoryLimitMiB").toLongLong(&ok);
+		if (!ok || limitMiB <= 0)
+			limitMiB = budget.limit() / (1024 * 1024);
+
+		budget.setLimit(std::clamp<qint64>(limitMiB, min_memory_limit_mib, max_memory_limit_mib) * 1024 * 1024);
 
 		auto numTabs = settings.beginReadArray("tabs");
 		for (int i = 0; i < numTabs; ++i)
@@ -275,6 +402,22 @@ QTabBar::tab:focus:selected {
 			if (sender() == tabs->currentWidget())
 				statusBar()->showMessage(name);
 		});
+		connect(view, &ImageView::nearingEnd, this, [this, view] {
+			if (view != tabs->currentWidget())
+				return;
+
+			// don't compete with the current archive while it is still being extracted
+			auto [completed, total] = view->getProgress();
+			if (completed < total)
+				return;
+
+			auto next = nextInSeries(view->archiveName());
+			if (!next.isEmpty() && !isOpen(next))
+				prefetch->prefetch(next);
+		});
+
+		if (auto prefetched = prefetch->take(filename))
+			view->addPrefetched(*prefetched);
 
 		int index = tabs->addTab(view, fileInfo.fileName());
 		tabs->setTabToolTip(index, filename);
@@ -285,7 +428,8 @@ QTabBar::tab:focus:selected {
 
 	void MainWindow::fileOpen() noexcept
 	{
-		auto filename = QFileDialog::getOpenFileName(this, tr("Select Image Archive"), lastPath, tr("Archive Files (*.zip *.rar *.7z *.tar.gz *.tar.bz2)"));
+		auto filename =
+			QFileDialog::getOpenFileName(this, tr("Select Image Archive"), lastPath, tr("Archive Files (%1)").arg(archiveNameFilters().join(' ')));
 		if (filename.isEmpty())
 			return;
 
@@ -293,11 +437,62 @@ QTabBar::tab:focus:selected {
 		addTab(filename);
 	}
 
+	void MainWindow::showLibrary() noexcept
+	{
+		for (int i = 0; i < tabs->count(); ++i)
+		{
+			if (qobject_cast<LibraryView *>(tabs->widget(i)))
+			{
+				tabs->setCurrentIndex(i);
+				return;
+			}
+		}
+
+		auto library = new LibraryView;
+		connect(library, &LibraryView::openRequested, this, &MainWindow::addTab);
+
+		auto index = tabs->insertTab(0, library, tr("Library"));
+		tabs->setCurrentIndex(index);
+		mainLayout->setCurrentIndex(1);
+	}
+
+	void MainWindow::fileOpenNext() noexcept
+	{
+		auto view = qobject_cast<ImageView *>(tabs->currentWidget());
+		if (!view)
+			return;
+
+		auto next = nextInSeries(view->archiveName());
+		if (next.isEmpty())
+		{
+			statusBar()->showMessage(tr("No next archive in this folder"));
+			return;
+		}
+
+		addTab(next);
+	}
+
+	bool MainWindow::isOpen(const QString &filename) const noexcept
+	{
+		for (int i = 0; i < tabs->count(); ++i)
+		{
+			auto view = qobject_cast<ImageView *>(tabs->widget(i));
+			if (view && view->archiveName() == filename)
+				return true;
+		}
+
+		return false;
+	}
+
 	void MainWindow::fileClose() noexcept
 	{
 		auto index = tabs->currentIndex();
 		if (index >= 0)
+		{
+			auto widget = tabs->widget(index);
 			tabs->removeTab(index);
+			delete widget;
+		}
 		else
 			mainLayout->setCurrentIndex(0);
 	}
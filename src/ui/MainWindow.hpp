@@ -5,6 +5,7 @@
 
 #include "Actions.hpp"
 
+class ArchivePrefetch;
 class QTabWidget;
 class QStackedLayout;
 
@@ -23,15 +24,19 @@ namespace ui
 		void closeEvent(QCloseEvent *event) override;
 		void readSettings() noexcept;
 		void addTab(const QString &archive) noexcept;
+		bool isOpen(const QString &filename) const noexcept;
 
 	private slots:
 		void fileOpen() noexcept;
+		void fileOpenNext() noexcept;
+		void showLibrary() noexcept;
 		void fileClose() noexcept;
 
 	private:
 		QTabWidget *tabs;
 		QStackedLayout *mainLayout;
 		ProgressWidget *progress;
+		ArchivePrefetch *prefetch;
 
 		QString lastPath;
 		Actions actions;
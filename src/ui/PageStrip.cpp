@@ -0,0 +1,735 @@
+#include "PageStrip.hpp"
+
+#include <QGestureEvent>
+#include <QKeyEvent>
+#include <QPaintEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QTimer>
+#include <QWheelEvent>
+
+#include <algorithm>
+#include <cmath>
+
+constexpr auto page_spacing = 8;
+constexpr auto min_zoom = 0.1;
+constexpr auto max_zoom = 16.0;
+constexpr auto zoom_step = 1.2;
+constexpr auto refine_delay_ms = 150;
+
+namespace ui
+{
+	PageStrip::PageStrip(QWidget *parent) noexcept : QAbstractScrollArea(parent), refineTimer(new QTimer(this)), relayoutTimer(new QTimer(this))
+	{
+		setFocusPolicy(Qt::StrongFocus);
+		viewport()->setAttribute(Qt::WA_OpaquePaintEvent);
+		viewport()->grabGesture(Qt::PinchGesture);
+
+		refineTimer->setSingleShot(true);
+		refineTimer->setInterval(refine_delay_ms);
+		connect(refineTimer, &QTimer::timeout, this, &PageStrip::refine);
+
+		// page sizes come in one at a time as thumbnails are decoded, lay them out together
+		relayoutTimer->setSingleShot(true);
+		relayoutTimer->setInterval(0);
+		connect(relayoutTimer, &QTimer::timeout, this, &PageStrip::relayout);
+	}
+
+	void PageStrip::setPageCount(int count) noexcept
+	{
+		for (auto &page : pages)
+			dropImage(page);
+
+		pages = QVector<Page>(count);
+		current = 0;
+		relayout();
+	}
+
+	int PageStrip::pageCount() const noexcept
+	{
+		return pages.size();
+	}
+
+	void PageStrip::setPageSize(int index, QSize size) noexcept
+	{
+		if (index < 0 || index >= pages.size() || !size.isValid() || pages[index].size == size)
+			return;
+
+		// pages we don't know about yet are most likely the same size as their neighbours
+		pages[index].size = size;
+		fallbackSize = size;
+		relayoutTimer->start();
+	}
+
+	void PageStrip::setPageImage(int index, QImage image) noexcept
+	{
+		if (index < 0 || index >= pages.size())
+			return;
+
+		// the page scrolled away while it was being prepared
+		auto r = rowOf(index);
+		if (r < keepFirst || r > keepLast)
+			return;
+
+		// an older request finishing late shouldn't replace an image that already fits
+		auto &page = pages[index];
+		if (page.image.size() == page.requestedSize && image.size() != page.requestedSize)
+			return;
+
+		dropMips(page);
+
+		auto delta = image.sizeInBytes() - page.image.sizeInBytes();
+		page.image = std::move(image);
+
+		viewport()->update(pageRects[index].translated(origin()));
+		emit imageMemoryChanged(delta);
+	}
+
+	void PageStrip::reloadPage(int index) noexcept
+	{
+		if (index < 0 || index >= pages.size())
+			return;
+
+		// a pending relayout requests the page once its place is known
+		pages[index].requestedSize = {};
+		if (!relayoutTimer->isActive())
+			updatePages();
+	}
+
+	void PageStrip::releaseImages(bool keepVisible) noexcept
+	{
+		auto first = rowCount();
+		auto last = -1;
+
+		if (keepVisible && !pages.isEmpty())
+		{
+			if (isPaged())
+				first = last = rowOf(current);
+			else
+			{
+				auto visible = visibleRect();
+				first = rowAt(visible.top());
+				last = rowAt(visible.bottom());
+			}
+		}
+
+		for (int i = 0; i < pages.size(); ++i)
+		{
+			auto r = rowOf(i);
+			if (r < first || r > last)
+				releasePage(i);
+		}
+
+		viewport()->update();
+	}
+
+	void PageStrip::setMode(ReadingMode mode) noexcept
+	{
+		if (readingMode == mode)
+			return;
+
+		readingMode = mode;
+		relayout();
+		setCurrentPage(current);
+	}
+
+	ReadingMode PageStrip::mode() const noexcept
+	{
+		return readingMode;
+	}
+
+	void PageStrip::setFit(bool width, bool height) noexcept
+	{
+		fitWidth = width;
+		fitHeight = height;
+		relayout();
+	}
+
+	void PageStrip::setZoom(double factor) noexcept
+	{
+		zoomAt(factor, QRectF(viewport()->rect()).center());
+	}
+
+	double PageStrip::zoom() const noexcept
+	{
+		return zoomFactor;
+	}
+
+	void PageStrip::zoomIn() noexcept
+	{
+		setZoom(zoomFactor * zoom_step);
+	}
+
+	void PageStrip::zoomOut() noexcept
+	{
+		setZoom(zoomFactor / zoom_step);
+	}
+
+	void PageStrip::setCurrentPage(int index) noexcept
+	{
+		if (pages.isEmpty())
+			return;
+
+		index = std::clamp(index, 0, int(pages.size()) - 1);
+		auto previousRow = rowOf(current);
+		current = index;
+
+		scrollingToPage = true;
+		if (isPaged())
+		{
+			if (rowOf(current) != previousRow)
+			{
+				updateScrollBars();
+				horizontalScrollBar()->setValue(0);
+				verticalScrollBar()->setValue(0);
+			}
+		}
+		else
+			verticalScrollBar()->setValue(rowRects[rowOf(current)].top());
+		scrollingToPage = false;
+
+		viewport()->update();
+		updatePages();
+	}
+
+	int PageStrip::currentPage() const noexcept
+	{
+		return current;
+	}
+
+	bool PageStrip::isPageVisible(int index) const noexcept
+	{
+		if (!isVisible() || index < 0 || index >= pages.size())
+			return false;
+
+		if (isPaged() && rowOf(index) != rowOf(current))
+			return false;
+
+		return pageRects[index].translated(origin()).intersects(viewport()->rect());
+	}
+
+	bool PageStrip::hasPageImage(int index) const noexcept
+	{
+		return index >= 0 && index < pages.size() && !pages[index].image.isNull();
+	}
+
+	void PageStrip::paintEvent(QPaintEvent *event)
+	{
+		QPainter painter(viewport());
+		painter.fillRect(event->rect(), palette().window());
+
+		if (pages.isEmpty())
+			return;
+
+		auto offset = origin();
+		auto visible = visibleRect();
+		auto dpr = devicePixelRatioF();
+		auto mipBytes = qint64{0};
+
+		// nearest neighbour keeps up with a zoom in progress, the refinement pass smooths it over
+		painter.setRenderHint(QPainter::SmoothPixmapTransform, !zooming);
+
+		auto firstRow = isPaged() ? rowOf(current) : rowAt(visible.top());
+		auto lastRow = isPaged() ? firstRow : rowAt(visible.bottom());
+
+		for (int r = firstRow; r <= lastRow; ++r)
+		{
+			auto [first, count] = row(r);
+			for (int i = first; i < first + count; ++i)
+			{
+				auto target = pageRects[i].translated(offset);
+				if (!event->rect().intersects(target))
+					continue;
+
+				auto &page = pages[i];
+				if (page.image.isNull())
+					painter.fillRect(target, palette().mid());
+				else
+					painter.drawImage(target, mipFor(page, (QSizeF(target.size()) * dpr).toSize(), mipBytes));
+			}
+		}
+
+		// budget changes are only reported once painting is done, as they may cause images to be dropped
+		if (mipBytes > 0)
+			emit imageMemoryChanged(mipBytes);
+	}
+
+	void PageStrip::resizeEvent(QResizeEvent *event)
+	{
+		QAbstractScrollArea::resizeEvent(event);
+		relayout();
+	}
+
+	void PageStrip::showEvent(QShowEvent *event)
+	{
+		QAbstractScrollArea::showEvent(event);
+		updatePages();
+	}
+
+	void PageStrip::hideEvent(QHideEvent *event)
+	{
+		QAbstractScrollArea::hideEvent(event);
+		emit visiblePagesChanged();
+	}
+
+	void PageStrip::scrollContentsBy([[maybe_unused]] int dx, [[maybe_unused]] int dy)
+	{
+		viewport()->update();
+
+		if (!scrollingToPage)
+			updateCurrentFromScroll();
+
+		updatePages();
+	}
+
+	void PageStrip::keyPressEvent(QKeyEvent *event)
+	{
+		if (!isPaged() || pages.isEmpty())
+		{
+			QAbstractScrollArea::keyPressEvent(event);
+			return;
+		}
+
+		auto r = rowOf(current);
+		auto bar = verticalScrollBar();
+
+		switch (event->key())
+		{
+		case Qt::Key_Right:
+			showRow(r + 1);
+			break;
+
+		case Qt::Key_Left:
+			showRow(r - 1);
+			break;
+
+		case Qt::Key_Space:
+		case Qt::Key_PageDown:
+			// scroll through a page taller than the view before moving on to the next one
+			if (bar->value() < bar->maximum())
+				bar->triggerAction(QAbstractSlider::SliderPageStepAdd);
+			else
+				showRow(r + 1);
+			break;
+
+		case Qt::Key_Backspace:
+		case Qt::Key_PageUp:
+			if (bar->value() > bar->minimum())
+				bar->triggerAction(QAbstractSlider::SliderPageStepSub);
+			else
+				showRow(r - 1);
+			break;
+
+		default:
+			QAbstractScrollArea::keyPressEvent(event);
+			break;
+		}
+	}
+
+	void PageStrip::wheelEvent(QWheelEvent *event)
+	{
+		if (!(event->modifiers() & Qt::ControlModifier))
+		{
+			QAbstractScrollArea::wheelEvent(event);
+			return;
+		}
+
+		auto notches = event->angleDelta().y() / 120.0;
+		zoomAt(zoomFactor * std::pow(zoom_step, notches), event->position());
+		event->accept();
+	}
+
+	bool PageStrip::viewportEvent(QEvent *event)
+	{
+		if (event->type() == QEvent::Gesture)
+		{
+			auto gestureEvent = static_cast<QGestureEvent *>(event);
+			if (auto pinch = static_cast<QPinchGesture *>(gestureEvent->gesture(Qt::PinchGesture)))
+			{
+				if (pinch->changeFlags() & QPinchGesture::ScaleFactorChanged)
+					zoomAt(zoomFactor * pinch->scaleFactor(), viewport()->mapFromGlobal(pinch->centerPoint().toPoint()));
+
+				gestureEvent->accept(pinch);
+				return true;
+			}
+		}
+		else if (event->type() == QEvent::NativeGesture)
+		{
+			// trackpads on macOS send their own zoom gestures instead
+			auto gesture = static_cast<QNativeGestureEvent *>(event);
+			if (gesture->gestureType() == Qt::ZoomNativeGesture)
+			{
+				zoomAt(zoomFactor * (1.0 + gesture->value()), gesture->localPos());
+				return true;
+			}
+		}
+
+		return QAbstractScrollArea::viewportEvent(event);
+	}
+
+	QSize PageStrip::naturalSize(int index) const noexcept
+	{
+		auto size = pages[index].size;
+		return size.isValid() ? size : fallbackSize;
+	}
+
+	QSize PageStrip::displaySize(int index, int pagesInRow) const noexcept
+	{
+		auto size = QSizeF(naturalSize(index));
+		auto available = QSizeF(viewport()->size());
+		available.setWidth((available.width() - page_spacing * (pagesInRow - 1)) / pagesInRow);
+
+		auto scale = 1.0;
+		if (fitWidth && fitHeight)
+			scale = std::min(available.width() / size.width(), available.height() / size.height());
+		else if (fitWidth)
+			scale = available.width() / size.width();
+		else if (fitHeight)
+			scale = available.height() / size.height();
+
+		scale *= zoomFactor;
+
+		return {std::max(1, qRound(size.width() * scale)), std::max(1, qRound(size.height() * scale))};
+	}
+
+	QSize PageStrip::requestSize(int index) const noexcept
+	{
+		auto target = (QSizeF(pageRects[index].size()) * devicePixelRatioF()).toSize();
+
+		// past the original resolution there is no more detail to decode, painting scales up from there
+		auto original = pages[index].size;
+		if (original.isValid() && (target.width() > original.width() || target.height() > original.height()))
+			return original;
+
+		return target;
+	}
+
+	int PageStrip::rowCount() const noexcept
+	{
+		if (readingMode == ReadingMode::Spread && !pages.isEmpty())
+			return 1 + pages.size() / 2;
+
+		return pages.size();
+	}
+
+	PageStrip::Row PageStrip::row(int index) const noexcept
+	{
+		// spreads show the cover on its own, then pages side by side
+		if (readingMode == ReadingMode::Spread && index > 0)
+		{
+			auto first = index * 2 - 1;
+			return {first, std::min(2, int(pages.size()) - first)};
+		}
+
+		return {index, 1};
+	}
+
+	int PageStrip::rowOf(int page) const noexcept
+	{
+		if (readingMode == ReadingMode::Spread)
+			return (page + 1) / 2;
+
+		return page;
+	}
+
+	int PageStrip::rowAt(int y) const noexcept
+	{
+		auto it = std::upper_bound(rowRects.begin(), rowRects.end(), y, [](int value, const QRect &rect) { return value < rect.top(); });
+		auto index = int(it - rowRects.begin()) - 1;
+		return std::clamp(index, 0, std::max(0, int(rowRects.size()) - 1));
+	}
+
+	bool PageStrip::isPaged() const noexcept
+	{
+		return readingMode != ReadingMode::Continuous;
+	}
+
+	void PageStrip::relayout() noexcept
+	{
+		relayoutTimer->stop();
+
+		auto rows = rowCount();
+
+		// keep the current row where it is on screen while the pages around it change size
+		auto anchored = !isPaged() && rowOf(current) < rowRects.size();
+		auto anchorOffset = anchored ? verticalScrollBar()->value() - rowRects[rowOf(current)].top() : 0;
+
+		pageRects.resize(pages.size());
+		rowRects.resize(rows);
+
+		auto y = 0;
+		auto width = 0;
+
+		for (int r = 0; r < rows; ++r)
+		{
+			auto [first, count] = row(r);
+			auto x = 0;
+			auto height = 0;
+
+			for (int i = first; i < first + count; ++i)
+			{
+				auto size = displaySize(i, count);
+				pageRects[i] = QRect(QPoint(x, y), size);
+				x += size.width() + page_spacing;
+				height = std::max(height, size.height());
+			}
+
+			for (int i = first; i < first + count; ++i)
+				pageRects[i].moveTop(y + (height - pageRects[i].height()) / 2);
+
+			rowRects[r] = QRect(0, y, x - page_spacing, height);
+			width = std::max(width, rowRects[r].width());
+			y += height + page_spacing;
+		}
+
+		for (int r = 0; r < rows; ++r)
+		{
+			auto dx = (width - rowRects[r].width()) / 2;
+			rowRects[r].translate(dx, 0);
+
+			auto [first, count] = row(r);
+			for (int i = first; i < first + count; ++i)
+				pageRects[i].translate(dx, 0);
+		}
+
+		contentSize = QSize(width, std::max(0, y - page_spacing));
+
+		scrollingToPage = true;
+		updateScrollBars();
+		if (anchored && rowOf(current) < rowRects.size())
+			verticalScrollBar()->setValue(rowRects[rowOf(current)].top() + anchorOffset);
+		scrollingToPage = false;
+
+		viewport()->update();
+		updatePages();
+	}
+
+	void PageStrip::updateScrollBars() noexcept
+	{
+		auto content = contentRect().size();
+		auto view = viewport()->size();
+
+		horizontalScrollBar()->setRange(0, std::max(0, content.width() - view.width()));
+		horizontalScrollBar()->setPageStep(view.width());
+		horizontalScrollBar()->setSingleStep(std::max(1, view.width() / 20));
+
+		verticalScrollBar()->setRange(0, std::max(0, content.height() - view.height()));
+		verticalScrollBar()->setPageStep(view.height());
+		verticalScrollBar()->setSingleStep(std::max(1, view.height() / 20));
+	}
+
+	QRect PageStrip::contentRect() const noexcept
+	{
+		if (!isPaged())
+			return {QPoint(), contentSize};
+
+		auto r = rowOf(current);
+		if (r < rowRects.size())
+			return rowRects[r];
+
+		return {};
+	}
+
+	QPoint PageStrip::origin() const noexcept
+	{
+		auto content = contentRect();
+		auto view = viewport()->size();
+
+		auto x = std::max(0, (view.width() - content.width()) / 2) - horizontalScrollBar()->value() - content.left();
+		auto y = std::max(0, (view.height() - content.height()) / 2) - verticalScrollBar()->value() - content.top();
+
+		return {x, y};
+	}
+
+	QRect PageStrip::visibleRect() const noexcept
+	{
+		return {-origin(), viewport()->size()};
+	}
+
+	void PageStrip::updatePages() noexcept
+	{
+		if (pages.isEmpty() || !isVisible())
+			return;
+
+		auto rows = rowCount();
+		auto currentRow = rowOf(current);
+		int wantFirst, wantLast;
+
+		if (isPaged())
+		{
+			// the rows either side are prepared so flipping pages is instant
+			wantFirst = currentRow - 1;
+			wantLast = currentRow + 1;
+			keepFirst = currentRow - 2;
+			keepLast = currentRow + 2;
+		}
+		else
+		{
+			auto visible = visibleRect();
+			auto height = visible.height();
+
+			wantFirst = rowAt(visible.top() - height);
+			wantLast = rowAt(visible.bottom() + height);
+			keepFirst = rowAt(visible.top() - height * 2);
+			keepLast = rowAt(visible.bottom() + height * 2);
+		}
+
+		for (int i = 0; i < pages.size(); ++i)
+		{
+			auto r = rowOf(i);
+			if (r < keepFirst || r > keepLast)
+				releasePage(i);
+		}
+
+		// requesting every step of a zoom would only pile up decodes that are outdated on arrival
+		if (zooming)
+		{
+			emit visiblePagesChanged();
+			return;
+		}
+
+		auto request = [&](int r) {
+			if (r < std::max(0, wantFirst) || r > std::min(rows - 1, wantLast))
+				return;
+
+			auto [first, count] = row(r);
+			for (int i = first; i < first + count; ++i)
+			{
+				auto &page = pages[i];
+				auto target = requestSize(i);
+				if (page.image.size() == target || page.requestedSize == target)
+					continue;
+
+				page.requestedSize = target;
+				emit pageNeeded(i, target);
+			}
+		};
+
+		// ask for the pages nearest the current one first
+		request(currentRow);
+		for (int distance = 1; currentRow - distance >= wantFirst || currentRow + distance <= wantLast; ++distance)
+		{
+			request(currentRow + distance);
+			request(currentRow - distance);
+		}
+
+		emit visiblePagesChanged();
+	}
+
+	void PageStrip::updateCurrentFromScroll() noexcept
+	{
+		if (isPaged() || pages.isEmpty())
+			return;
+
+		// the page covering the upper part of the view is the one being read
+		auto visible = visibleRect();
+		auto page = row(rowAt(visible.top() + visible.height() / 4)).first;
+
+		if (page != current)
+		{
+			current = page;
+			emit currentPageChanged(current);
+		}
+	}
+
+	void PageStrip::showRow(int r) noexcept
+	{
+		if (r < 0 || r >= rowCount())
+			return;
+
+		setCurrentPage(row(r).first);
+		emit currentPageChanged(current);
+	}
+
+	void PageStrip::releasePage(int index) noexcept
+	{
+		auto &page = pages[index];
+		if (page.image.isNull() && !page.requestedSize.isValid())
+			return;
+
+		dropImage(page);
+		page.requestedSize = {};
+		emit pageReleased(index);
+	}
+
+	void PageStrip::dropImage(Page &page) noexcept
+	{
+		if (page.image.isNull())
+			return;
+
+		dropMips(page);
+
+		auto bytes = page.image.sizeInBytes();
+		page.image = QImage();
+		emit imageMemoryChanged(-bytes);
+	}
+
+	void PageStrip::dropMips(Page &page) noexcept
+	{
+		if (page.mips.isEmpty())
+			return;
+
+		auto bytes = qint64{0};
+		for (const auto &mip : page.mips)
+			bytes += mip.sizeInBytes();
+
+		page.mips.clear();
+		emit imageMemoryChanged(-bytes);
+	}
+
+	const QImage &PageStrip::mipFor(Page &page, QSize target, qint64 &addedBytes) noexcept
+	{
+		// the smallest level still covering the target keeps scaling cheap without losing detail
+		const QImage *level = &page.image;
+		for (int i = 0;; ++i)
+		{
+			auto half = level->size() / 2;
+			if (half.isEmpty() || half.width() < target.width() || half.height() < target.height())
+				return *level;
+
+			if (i == page.mips.size())
+			{
+				auto mip = level->scaled(half, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+				if (level->format() == QImage::Format_Grayscale8 && mip.format() != QImage::Format_Grayscale8)
+					mip = std::move(mip).convertToFormat(QImage::Format_Grayscale8);
+
+				addedBytes += mip.sizeInBytes();
+				page.mips.append(std::move(mip));
+			}
+
+			level = &page.mips[i];
+		}
+	}
+
+	void PageStrip::zoomAt(double factor, QPointF anchor) noexcept
+	{
+		factor = std::clamp(factor, min_zoom, max_zoom);
+		if (qFuzzyCompare(factor, zoomFactor))
+			return;
+
+		// keep the part of the page under the anchor where it is
+		auto before = contentRect();
+		auto point = anchor - QPointF(origin()) - QPointF(before.topLeft());
+		auto ratio = factor / zoomFactor;
+
+		zoomFactor = factor;
+		zooming = true;
+		refineTimer->start();
+
+		relayout();
+
+		auto after = contentRect();
+		auto target = QPointF(after.topLeft()) + point * ratio;
+		auto view = viewport()->size();
+
+		horizontalScrollBar()->setValue(qRound(std::max(0, (view.width() - after.width()) / 2) - after.left() - anchor.x() + target.x()));
+		verticalScrollBar()->setValue(qRound(std::max(0, (view.height() - after.height()) / 2) - after.top() - anchor.y() + target.y()));
+	}
+
+	void PageStrip::refine() noexcept
+	{
+		zooming = false;
+		viewport()->update();
+		updatePages();
+	}
+}
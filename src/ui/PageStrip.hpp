@@ -0,0 +1,147 @@
+#pragma once
+
+#include <QAbstractScrollArea>
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QVector>
+
+class QTimer;
+
+namespace ui
+{
+	enum class ReadingMode
+	{
+		Single,
+		Spread,
+		Continuous,
+	};
+
+	// Lays out all pages of an archive from their known dimensions and paints the ones in
+	// view. Images are only kept for pages near the viewport; pageNeeded is emitted when a
+	// page comes close enough to be shown and setPageImage hands the scaled image back.
+	//
+	// While zooming, pages are painted from a lazily built mip pyramid of the image on hand
+	// and only asked for again at the new size once the zoom has settled.
+	class PageStrip final : public QAbstractScrollArea
+	{
+		Q_OBJECT
+
+	public:
+		explicit PageStrip(QWidget *parent = nullptr) noexcept;
+
+		void setPageCount(int count) noexcept;
+		int pageCount() const noexcept;
+
+		void setPageSize(int index, QSize size) noexcept;
+		void setPageImage(int index, QImage image) noexcept;
+
+		// Forget any outstanding request so the page is asked for again if it is still wanted
+		void reloadPage(int index) noexcept;
+
+		// Drop every image, or only those outside of the pages currently in view
+		void releaseImages(bool keepVisible) noexcept;
+
+		void setMode(ReadingMode mode) noexcept;
+		ReadingMode mode() const noexcept;
+
+		void setFit(bool width, bool height) noexcept;
+
+		// Scale on top of the fit, around the centre of the view
+		void setZoom(double factor) noexcept;
+		double zoom() const noexcept;
+		void zoomIn() noexcept;
+		void zoomOut() noexcept;
+
+		void setCurrentPage(int index) noexcept;
+		int currentPage() const noexcept;
+
+		bool isPageVisible(int index) const noexcept;
+
+		// Whether there is an image to show for the page, at whatever size
+		bool hasPageImage(int index) const noexcept;
+
+	signals:
+		void pageNeeded(int index, QSize size);
+		void pageReleased(int index);
+		void visiblePagesChanged();
+		void currentPageChanged(int index);
+		void imageMemoryChanged(qint64 delta);
+
+	protected:
+		void paintEvent(QPaintEvent *event) override;
+		void resizeEvent(QResizeEvent *event) override;
+		void showEvent(QShowEvent *event) override;
+		void hideEvent(QHideEvent *event) override;
+		void scrollContentsBy(int dx, int dy) override;
+		void keyPressEvent(QKeyEvent *event) override;
+		void wheelEvent(QWheelEvent *event) override;
+		bool viewportEvent(QEvent *event) override;
+
+	private:
+		struct Page
+		{
+			QSize size;
+			QImage image;
+			QSize requestedSize;
+
+			// successive halvings of image, built as they are needed for painting
+			QVector<QImage> mips;
+		};
+
+		struct Row
+		{
+			int first;
+			int count;
+		};
+
+		QSize naturalSize(int index) const noexcept;
+		QSize displaySize(int index, int pagesInRow) const noexcept;
+		QSize requestSize(int index) const noexcept;
+
+		int rowCount() const noexcept;
+		Row row(int index) const noexcept;
+		int rowOf(int page) const noexcept;
+		int rowAt(int y) const noexcept;
+		bool isPaged() const noexcept;
+
+		void relayout() noexcept;
+		void updateScrollBars() noexcept;
+		QRect contentRect() const noexcept;
+		QPoint origin() const noexcept;
+		QRect visibleRect() const noexcept;
+
+		void updatePages() noexcept;
+		void updateCurrentFromScroll() noexcept;
+		void showRow(int row) noexcept;
+		void dropImage(Page &page) noexcept;
+		void dropMips(Page &page) noexcept;
+		const QImage &mipFor(Page &page, QSize target, qint64 &addedBytes) noexcept;
+
+		void zoomAt(double factor, QPointF anchor) noexcept;
+		void refine() noexcept;
+		void releasePage(int index) noexcept;
+
+	private:
+		QVector<Page> pages;
+		QVector<QRect> pageRects;
+		QVector<QRect> rowRects;
+		QSize fallbackSize{1000, 1414};
+		QSize contentSize;
+
+		ReadingMode readingMode = ReadingMode::Single;
+		bool fitWidth = false;
+		bool fitHeight = false;
+		double zoomFactor = 1.0;
+
+		// set between zoom steps, when pages are painted fast and not requested again
+		bool zooming = false;
+		QTimer *refineTimer;
+		QTimer *relayoutTimer;
+
+		int current = 0;
+		int keepFirst = 0;
+		int keepLast = -1;
+		bool scrollingToPage = false;
+	};
+}